@@ -44,7 +44,7 @@
 #   )
 function(add_slang_shader TargetName)
 	set(options)
-	set(oneValueArgs SOURCE ENTRY STAGE)
+	set(oneValueArgs SOURCE ENTRY STAGE OUTPUT_NAME)
 	set(multiValueArgs SLANG_INCLUDE_DIRECTORIES)
 	cmake_parse_arguments(arg "${options}" "${oneValueArgs}" "${multiValueArgs}" ${ARGN})
 
@@ -60,6 +60,10 @@ function(add_slang_shader TargetName)
 	# The generated WGSL file
 	cmake_path(GET arg_SOURCE PARENT_PATH parent)
 	cmake_path(GET arg_SOURCE STEM LAST_ONLY stem)
+	# several entry points of one source need their own output names
+	if (arg_OUTPUT_NAME)
+		set(stem ${arg_OUTPUT_NAME})
+	endif()
 	set(SPIRV_SHADER_DIR "${CMAKE_RUNTIME_OUTPUT_DIRECTORY}/shaders")
 	set(SPIRV_SHADER "${SPIRV_SHADER_DIR}/${stem}.${arg_STAGE}.spv")
 
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <vk_types.h>
+
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+// writes the rendered frames of a sequence to disk. a captured frame copies
+// the draw image into the readback buffer of its frame in flight, which is
+// read once the cpu has waited for that frame anyway. encoding happens on
+// writer threads, so neither the gpu nor the render thread waits for it
+struct FrameCapture {
+  enum class Format {
+    // 8 bit rgb, clamped like the blit to the swapchain
+    Png,
+    // the pixels as the gpu wrote them, tightly packed without a header
+    Raw,
+  };
+
+  // frames waiting for a writer before the render thread has to wait as well
+  static constexpr size_t MAX_QUEUED_FRAMES = 32;
+
+  // extent and format of the image every captured frame copies from. 0
+  // writers uses a quarter of the hardware threads
+  void init(VmaAllocator allocator, VkExtent3D extent, VkFormat format,
+            uint32_t frameCount, unsigned writerCount = 0);
+  // writes everything still pending, only call once the device is idle
+  void destroy();
+
+  // captures the next frames into directory/frame_00000.png and so on,
+  // replacing a running capture
+  void begin(uint32_t frames, std::filesystem::path directory, Format format);
+  // frames left to record in the running capture
+  uint32_t remaining() const { return _remaining; }
+  // captured frames not written yet
+  size_t queued();
+
+  // hands what the frame's buffer read back the last time it was used to the
+  // writers. only call once the gpu is done with the frame
+  void begin_frame(uint32_t frameIndex);
+  // the buffer the current frame has to copy into, VK_NULL_HANDLE when it is
+  // not captured. claims the next frame of the sequence
+  VkBuffer capture_frame();
+  // copies image, in TRANSFER_SRC_OPTIMAL, into the current frame's buffer
+  void record_copy(VkCommandBuffer cmd, VkImage image);
+
+private:
+  struct Slot {
+    AllocatedBuffer buffer{};
+    // where the frame copied into it goes, empty when there is none
+    std::filesystem::path path;
+    Format format{Format::Png};
+  };
+
+  struct Job {
+    std::filesystem::path path;
+    Format format{Format::Png};
+    std::vector<uint8_t> pixels;
+  };
+
+  void collect(Slot &slot);
+  void writer_main();
+  void write(const Job &job);
+
+  VmaAllocator _allocator{};
+  VkExtent3D _extent{};
+  VkFormat _format{VK_FORMAT_UNDEFINED};
+  VkDeviceSize _frameBytes{0};
+
+  std::vector<Slot> _slots;
+  uint32_t _current{0};
+
+  uint32_t _remaining{0};
+  uint32_t _nextIndex{0};
+  std::filesystem::path _directory;
+  Format _captureFormat{Format::Png};
+
+  std::vector<std::thread> _writers;
+  std::mutex _mutex;
+  std::condition_variable _jobAdded;
+  std::condition_variable _jobTaken;
+  std::deque<Job> _jobs;
+  // jobs taken by a writer and not finished yet
+  size_t _writing{0};
+  bool _stopping{false};
+};
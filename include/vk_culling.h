@@ -0,0 +1,44 @@
+#pragma once
+
+#include <vk_types.h>
+
+class JobSystem;
+
+// view frustum as six planes, xyz is the inward facing normal and w the
+// distance so that dot(plane.xyz, p) + plane.w >= 0 inside
+struct Frustum {
+  std::array<glm::vec4, 6> planes;
+};
+
+// extracts the planes of a projection * view matrix. both depth planes come
+// from the z row, so it works the same with reversed depth
+Frustum make_frustum(const glm::mat4 &viewProj);
+
+// world space bounds of every object, one array per component so the
+// frustum test can load four objects per instruction
+struct CullingBounds {
+  std::vector<float> centerX, centerY, centerZ;
+  std::vector<float> radius;
+  // half size of the world space box around the center
+  std::vector<float> extentX, extentY, extentZ;
+
+  size_t size() const { return centerX.size(); }
+  void clear();
+  void push_back(glm::vec3 center, float sphereRadius, glm::vec3 extents);
+};
+
+struct CullingStats {
+  uint32_t tested;
+  uint32_t visible;
+  double milliseconds;
+};
+
+// writes the indices of the objects whose sphere and box both touch the
+// frustum to visible, and returns how long it took
+CullingStats cull_frustum(const Frustum &frustum, const CullingBounds &bounds,
+                          std::vector<uint32_t> &visible);
+
+// same, split into chunks across the job system. visible keeps the order of
+// the serial version
+CullingStats cull_frustum(const Frustum &frustum, const CullingBounds &bounds,
+                          std::vector<uint32_t> &visible, JobSystem &jobs);
@@ -4,12 +4,62 @@
 #define GLFW_INCLUDE_VULKAN
 #include <GLFW/glfw3.h>
 #include <vector>
+#include <vk_profiler.h>
 #include <vk_types.h>
 
+struct MeshAsset;
+
+// one object of a scene the application builds, see set_scene()
+struct SceneInstance {
+  const MeshAsset *mesh;
+  glm::mat4 transform;
+};
+
+// one memory heap of the device as the allocator sees it, in bytes
+struct MemoryHeapUsage {
+  bool deviceLocal;
+  // taken by the allocations of the engine
+  VkDeviceSize allocationBytes;
+  // taken by the whole process, and what the driver is willing to give it
+  VkDeviceSize usageBytes;
+  VkDeviceSize budgetBytes;
+};
+
+// settings fixed for the lifetime of the engine
+struct EngineOptions {
+  // frames the cpu may record ahead of the gpu, 1 to 4. more of them absorb
+  // stalls on either side at the cost of latency
+  uint32_t framesInFlight{2};
+  // falls back to FIFO when the surface does not support it. can be changed
+  // from the ui later
+  VkPresentModeKHR presentMode{VK_PRESENT_MODE_FIFO_KHR};
+  // wait for the previous frame to reach the screen before sampling input
+  bool lowLatency{false};
+  // captures the cpu zones of this many frames after startup into a chrome
+  // trace, 0 leaves it to the ui
+  uint32_t cpuTraceFrames{0};
+  // writes the frames after startup to captureDirectory, as png or as the
+  // raw pixels of the draw image
+  uint32_t captureFrames{0};
+  std::string captureDirectory{"captures"};
+  bool captureRaw{false};
+  // render to the offscreen draw image without a window or swapchain, for
+  // machines without a display and software drivers like lavapipe
+  bool headless{false};
+  // frames to render headless before run() returns, 0 renders until
+  // request_stop()
+  uint32_t headlessFrames{0};
+  // loads assets/basicmesh.glb and builds the grid scene. without it the
+  // application has to call set_scene() before the first frame
+  bool defaultScene{true};
+  // the validation layers cost a lot of cpu time, benchmarks turn them off
+  bool validation{true};
+};
+
 class VulkanEngine {
 public:
   // initializes everything in the engine
-  void init();
+  void init(const EngineOptions &options = {});
 
   // shuts down the engine
   void cleanup();
@@ -19,9 +69,24 @@ public:
 
   // run main loop
   void run();
+  // makes run() return after the current frame, callable from any thread
+  void request_stop();
 
   GPUMeshBuffers uploadMesh(std::span<uint32_t> indices,
                             std::span<Vertex> vertices);
+  // uploads every mesh through one staging buffer and a single submit
+  std::vector<GPUMeshBuffers>
+  uploadMeshes(std::span<const MeshUploadInfo> meshes);
+
+  // builds the scene from meshes uploaded by the application, once, and only
+  // without the default scene
+  void set_scene(std::span<const SceneInstance> instances);
+  // world to view transform used from the next frame on
+  void set_camera(const glm::mat4 &view);
+
+  // gpu time of every profiled pass, empty without timestamp support
+  std::vector<GpuProfiler::ScopeStats> gpu_pass_stats() const;
+  std::vector<MemoryHeapUsage> memory_usage() const;
 
   VulkanEngine();
   ~VulkanEngine() noexcept;
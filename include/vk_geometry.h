@@ -0,0 +1,65 @@
+#pragma once
+
+#include <vk_types.h>
+
+// first-fit allocator handing out byte ranges of a fixed size. the free list
+// is kept sorted by offset so neighbouring blocks merge back on free
+struct RangeAllocator {
+  struct Block {
+    VkDeviceSize offset;
+    VkDeviceSize size;
+  };
+
+  std::vector<Block> freeBlocks;
+  VkDeviceSize capacity;
+  VkDeviceSize used;
+
+  void init(VkDeviceSize size);
+  // returns false when no free block can fit the range
+  bool allocate(VkDeviceSize size, VkDeviceSize alignment,
+                VkDeviceSize *outOffset);
+  void free(VkDeviceSize offset, VkDeviceSize size);
+};
+
+// a couple of large device local buffers that every mesh sub-allocates its
+// vertices and indices from, so draws only need to bind one index buffer
+struct GeometryPool {
+  AllocatedBuffer vertexBuffer;
+  AllocatedBuffer indexBuffer;
+  VkDeviceAddress vertexBufferAddress;
+
+  RangeAllocator vertexRanges;
+  RangeAllocator indexRanges;
+
+  // the buffers are shared between every queue family in queueFamilies, so
+  // the transfer queue can fill them while the graphics queue draws
+  void init(VkDevice device, VmaAllocator allocator,
+            VkDeviceSize vertexCapacity, VkDeviceSize indexCapacity,
+            std::span<const uint32_t> queueFamilies);
+  void destroy(VmaAllocator allocator);
+
+  // reserves the ranges for a mesh, aborting when the pool is exhausted.
+  // meshes with at most 65536 vertices get 16 bit indices
+  GPUMeshBuffers allocate(VertexFormat format, size_t vertexCount,
+                          size_t indexCount);
+  void free(const GPUMeshBuffers &mesh);
+};
+
+// bytes one index takes on the gpu
+size_t index_stride(VkIndexType type);
+
+// narrows indices to type, they must all fit
+void pack_indices(std::span<const uint32_t> indices, VkIndexType type,
+                  std::vector<std::byte> &out);
+
+// bytes one vertex takes on the gpu in the given format
+size_t vertex_stride(VertexFormat format);
+
+// encodes vertices into the gpu layout of mesh.vertexFormat. for quantized
+// positions the mesh bounds are written back to mesh
+void pack_vertices(std::span<const Vertex> vertices, GPUMeshBuffers &mesh,
+                   std::vector<std::byte> &out);
+
+// undoes the position quantization of the mesh, multiply the world matrix by
+// it before drawing
+glm::mat4 dequantize_matrix(const GPUMeshBuffers &mesh);
@@ -9,4 +9,19 @@ void transition_image(VkCommandBuffer cmd, VkImage image,
 void copy_image_to_image(VkCommandBuffer cmd, VkImage source,
                          VkImage destination, VkExtent2D srcSize,
                          VkExtent2D dstSize);
+
+// the two halves of a queue family ownership transfer of a color image. the
+// queue giving it away records the release, the queue taking it records the
+// acquire after waiting on a semaphore the release signals. both pass the
+// same families and layouts, the transition happens once between them.
+// acquire with both families VK_QUEUE_FAMILY_IGNORED is a plain transition
+// of an image no earlier work on the queue has to finish with
+void release_image(VkCommandBuffer cmd, VkImage image, uint32_t srcFamily,
+                   uint32_t dstFamily, VkImageLayout oldLayout,
+                   VkImageLayout newLayout, VkPipelineStageFlags2 srcStage,
+                   VkAccessFlags2 srcAccess);
+void acquire_image(VkCommandBuffer cmd, VkImage image, uint32_t srcFamily,
+                   uint32_t dstFamily, VkImageLayout oldLayout,
+                   VkImageLayout newLayout, VkPipelineStageFlags2 dstStage,
+                   VkAccessFlags2 dstAccess);
 } // namespace vkutil
\ No newline at end of file
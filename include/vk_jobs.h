@@ -0,0 +1,77 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <thread>
+#include <vector>
+
+// completion state of a scheduled job or parallel_for, other jobs can depend
+// on it and any thread can wait for it
+struct JobCounter;
+using JobHandle = std::shared_ptr<JobCounter>;
+
+// work stealing scheduler. every worker owns a deque it pushes and pops at
+// the back, idle workers steal from the front of the others. jobs scheduled
+// from outside the pool go to a shared queue, and threads waiting on a
+// handle run queued jobs instead of blocking, so waiting inside a job is fine
+class JobSystem {
+public:
+  using Job = std::function<void()>;
+  using RangeJob = std::function<void(size_t begin, size_t end)>;
+
+  // 0 uses one worker per hardware thread besides the calling one. with no
+  // workers at all every job runs inside wait()
+  explicit JobSystem(unsigned workerCount = 0);
+  ~JobSystem();
+
+  JobSystem(const JobSystem &) = delete;
+  JobSystem &operator=(const JobSystem &) = delete;
+
+  // runs job once every dependency has completed
+  JobHandle schedule(Job job, std::span<const JobHandle> dependencies = {});
+
+  // splits [0, count) into chunks of grain items, 0 picks a grain that gives
+  // every thread a few chunks. the handle completes with the last chunk
+  JobHandle parallel_for(size_t count, size_t grain, RangeJob job,
+                         std::span<const JobHandle> dependencies = {});
+
+  // runs queued jobs on the calling thread until handle completes
+  void wait(const JobHandle &handle);
+  static bool is_done(const JobHandle &handle);
+
+  unsigned worker_count() const { return (unsigned)_workers.size(); }
+  // threads able to run jobs, the workers plus the one waiting
+  unsigned thread_count() const { return worker_count() + 1; }
+
+private:
+  struct Task {
+    Job job;
+    JobHandle counter;
+  };
+
+  struct Queue {
+    std::mutex mutex;
+    std::deque<Task> tasks;
+  };
+
+  void enqueue(std::vector<Task> tasks);
+  bool try_run_one(size_t queueIndex);
+  void run(Task &task);
+  void worker_main(size_t index);
+  JobHandle submit(std::vector<Task> tasks, JobHandle counter,
+                   std::span<const JobHandle> dependencies);
+
+  // one per worker, the last one is the shared queue of outside threads
+  std::vector<std::unique_ptr<Queue>> _queues;
+  std::vector<std::thread> _workers;
+
+  std::mutex _sleepMutex;
+  std::condition_variable _wake;
+  std::atomic<size_t> _queued{0};
+  bool _stopping{false};
+};
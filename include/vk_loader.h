@@ -1,10 +1,23 @@
+#pragma once
+
 #include <filesystem>
 #include <unordered_map>
 #include <vk_types.h>
 
+class JobSystem;
+
+// bounding volumes of a surface in mesh space: a box of half size extents
+// and a sphere, both centered on origin
+struct Bounds {
+  glm::vec3 origin;
+  float sphereRadius;
+  glm::vec3 extents;
+};
+
 struct GeoSurface {
   uint32_t startIndex;
   uint32_t count;
+  Bounds bounds;
 };
 
 struct MeshAsset {
@@ -14,8 +27,28 @@ struct MeshAsset {
   GPUMeshBuffers meshBuffers;
 };
 
+struct GltfLoadOptions {
+  // number of threads decoding meshes. 0 uses every hardware thread, 1 runs
+  // the old serial path so the two can be compared
+  unsigned workerCount{0};
+  // decodes on these workers instead of starting threads for the load.
+  // workerCount 1 still decodes serially
+  JobSystem *jobs{nullptr};
+  // reuse the preprocessed <file>.meshcache next to the source when it was
+  // cooked from the same file, and write it after decoding otherwise
+  bool useMeshCache{true};
+  // reorder triangles for the post-transform cache and overdraw, then
+  // vertices for fetch locality, and print the statistics of every mesh
+  bool optimizeMeshes{true};
+};
+
 // forward declaration
 class VulkanEngine;
 
 std::optional<std::vector<std::shared_ptr<MeshAsset>>>
-loadGltfMeshes(VulkanEngine *engine, std::filesystem::path filePath);
\ No newline at end of file
+loadGltfMeshes(VulkanEngine *engine, std::filesystem::path filePath,
+               const GltfLoadOptions &options = {});
+
+// decodes filePath and writes its mesh cache without touching the gpu
+bool cookGltfMeshes(std::filesystem::path filePath,
+                    const GltfLoadOptions &options = {});
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <vk_loader.h>
+
+#include <string_view>
+
+// read only view of a whole file, memory mapped on posix systems and read
+// into memory elsewhere
+class MappedFile {
+public:
+  static std::shared_ptr<MappedFile> open(const std::filesystem::path &path);
+
+  MappedFile(const MappedFile &) = delete;
+  MappedFile &operator=(const MappedFile &) = delete;
+  ~MappedFile() noexcept;
+
+  const std::byte *data() const { return _data; }
+  size_t size() const { return _size; }
+
+private:
+  MappedFile() = default;
+
+  const std::byte *_data{};
+  size_t _size{};
+  std::vector<std::byte> _fallback;
+};
+
+// one mesh as laid out in the cache file. when read back the spans point into
+// the mapped file
+struct CachedMesh {
+  std::string_view name;
+  std::span<const GeoSurface> surfaces;
+  std::span<const Vertex> vertices;
+  std::span<const uint32_t> indices;
+};
+
+// preprocessed meshes of one source asset, mapped from disk so the vertex and
+// index blobs can be copied straight into staging memory
+struct MeshCache {
+  std::shared_ptr<MappedFile> file;
+  std::vector<CachedMesh> meshes;
+
+  // fails when the file is missing, corrupt, or was cooked from a different
+  // source file or with different flags
+  static std::optional<MeshCache> open(const std::filesystem::path &path,
+                                       uint64_t sourceHash, uint32_t flags);
+  static bool write(const std::filesystem::path &path, uint64_t sourceHash,
+                    uint32_t flags, std::span<const CachedMesh> meshes);
+};
+
+// 64 bit FNV-1a of the file contents, 0 when it can't be read
+uint64_t hash_file(const std::filesystem::path &path);
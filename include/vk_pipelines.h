@@ -31,9 +31,19 @@ public:
   void disable_depthtest();
   void clear();
 
-  VkPipeline build_pipeline(VkDevice device);
+  VkPipeline build_pipeline(VkDevice device,
+                            VkPipelineCache cache = VK_NULL_HANDLE);
 };
 
 bool load_shader_module(std::filesystem::path filePath, VkDevice device,
                         VkShaderModule *outShaderModule);
+
+// creates a pipeline cache seeded from filePath. the file is only used when
+// it was written on the same gpu and driver version, otherwise the cache
+// starts empty. outWarm tells whether any data was loaded
+VkPipelineCache load_pipeline_cache(std::filesystem::path filePath,
+                                    VkDevice device, VkPhysicalDevice gpu,
+                                    bool *outWarm = nullptr);
+bool save_pipeline_cache(std::filesystem::path filePath, VkDevice device,
+                         VkPhysicalDevice gpu, VkPipelineCache cache);
 } // namespace vkutil
\ No newline at end of file
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <vk_types.h>
+
+#include <unordered_map>
+
+// times named scopes of gpu work with timestamp queries. every frame in
+// flight has its own query pool, read back once the cpu has waited for that
+// frame anyway, so reading never stalls. scopes can nest, and can be recorded
+// on every queue family given to init()
+struct GpuProfiler {
+  using ScopeId = uint32_t;
+  static constexpr ScopeId NO_SCOPE = ~0u;
+
+  // over the last HISTORY_SIZE frames that recorded the scope, milliseconds
+  struct ScopeStats {
+    std::string name;
+    // frames the numbers are taken over
+    size_t samples;
+    double average;
+    double p50;
+    double p95;
+    double p99;
+  };
+
+  static constexpr uint32_t MAX_SCOPES = 64;
+  static constexpr size_t HISTORY_SIZE = 256;
+
+  // disabled when one of the families has no timestamp support
+  void init(VkDevice device, VkPhysicalDevice physicalDevice,
+            std::span<const uint32_t> queueFamilies, uint32_t frameCount);
+  void destroy();
+
+  // collects what the frame's pool measured the last time it was used, then
+  // resets it from the host. only call once the gpu is done with the frame
+  void begin_frame(uint32_t frameIndex);
+
+  // scopes past MAX_SCOPES in a frame are dropped
+  ScopeId begin_scope(VkCommandBuffer cmd, std::string name);
+  void end_scope(VkCommandBuffer cmd, ScopeId scope);
+
+  // in the order the scopes were first seen
+  std::vector<ScopeStats> stats() const;
+
+  // nearest rank percentile of samples sorted ascending, p in [0, 1]
+  static double percentile(std::span<const double> sorted, double p);
+
+  bool enabled() const { return _timestampPeriod > 0; }
+
+private:
+  struct Frame {
+    VkQueryPool pool{VK_NULL_HANDLE};
+    // scope i owns queries 2i and 2i + 1
+    std::vector<std::string> names;
+  };
+
+  struct History {
+    std::vector<double> samples;
+    size_t next{0};
+  };
+
+  void record(const std::string &name, double milliseconds);
+
+  VkDevice _device{VK_NULL_HANDLE};
+  // nanoseconds per tick, 0 without timestamp support
+  double _timestampPeriod{0};
+  uint64_t _timestampMask{0};
+
+  std::vector<Frame> _frames;
+  uint32_t _current{0};
+
+  std::unordered_map<std::string, History> _history;
+  std::vector<std::string> _order;
+};
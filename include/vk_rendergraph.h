@@ -0,0 +1,210 @@
+#pragma once
+
+#include <vk_types.h>
+
+#include <unordered_map>
+
+struct GpuProfiler;
+
+// how a pass touches a resource. layout only matters for images
+struct ResourceUsage {
+  VkPipelineStageFlags2 stage;
+  VkAccessFlags2 access;
+  VkImageLayout layout{VK_IMAGE_LAYOUT_UNDEFINED};
+};
+
+// usages shared by the passes of the engine
+namespace rgusage {
+inline constexpr ResourceUsage ComputeStorageRead{
+    VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+    VK_ACCESS_2_SHADER_STORAGE_READ_BIT};
+inline constexpr ResourceUsage ComputeStorageWrite{
+    VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+    VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT};
+inline constexpr ResourceUsage ComputeStorageReadWrite{
+    VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+    VK_ACCESS_2_SHADER_STORAGE_READ_BIT | VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT};
+inline constexpr ResourceUsage ComputeStorageImageWrite{
+    VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+    VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT, VK_IMAGE_LAYOUT_GENERAL};
+inline constexpr ResourceUsage ComputeSampledGeneral{
+    VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_SAMPLED_READ_BIT,
+    VK_IMAGE_LAYOUT_GENERAL};
+inline constexpr ResourceUsage ComputeSampledDepth{
+    VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_SAMPLED_READ_BIT,
+    VK_IMAGE_LAYOUT_DEPTH_READ_ONLY_OPTIMAL};
+inline constexpr ResourceUsage ColorAttachment{
+    VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT,
+    VK_ACCESS_2_COLOR_ATTACHMENT_READ_BIT |
+        VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT,
+    VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL};
+inline constexpr ResourceUsage DepthAttachment{
+    VK_PIPELINE_STAGE_2_EARLY_FRAGMENT_TESTS_BIT |
+        VK_PIPELINE_STAGE_2_LATE_FRAGMENT_TESTS_BIT,
+    VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_READ_BIT |
+        VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+    VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL};
+inline constexpr ResourceUsage IndirectRead{
+    VK_PIPELINE_STAGE_2_DRAW_INDIRECT_BIT,
+    VK_ACCESS_2_INDIRECT_COMMAND_READ_BIT};
+inline constexpr ResourceUsage TransferRead{
+    VK_PIPELINE_STAGE_2_COPY_BIT | VK_PIPELINE_STAGE_2_BLIT_BIT,
+    VK_ACCESS_2_TRANSFER_READ_BIT, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL};
+inline constexpr ResourceUsage TransferWrite{
+    VK_PIPELINE_STAGE_2_COPY_BIT | VK_PIPELINE_STAGE_2_BLIT_BIT,
+    VK_ACCESS_2_TRANSFER_WRITE_BIT, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL};
+inline constexpr ResourceUsage Clear{VK_PIPELINE_STAGE_2_CLEAR_BIT,
+                                     VK_ACCESS_2_TRANSFER_WRITE_BIT};
+inline constexpr ResourceUsage HostRead{VK_PIPELINE_STAGE_2_HOST_BIT,
+                                        VK_ACCESS_2_HOST_READ_BIT};
+} // namespace rgusage
+
+// records a frame as passes that declare what they read and write. execute()
+// drops the passes nothing depends on, then runs the rest in order with one
+// batched barrier in front of each pass, covering exactly the stages and
+// accesses that conflict with what came before.
+//
+// resources are imported vulkan handles or transient images the graph owns.
+// the graph remembers the state each one was left in, so the next frame starts
+// from it, even across submissions. transient images only hold their contents
+// within a frame, the ones whose lifetimes do not overlap share memory
+struct RenderGraph {
+  using ResourceId = uint32_t;
+  using RecordFn = std::function<void(VkCommandBuffer cmd)>;
+
+  struct ResourceState {
+    VkImageLayout layout{VK_IMAGE_LAYOUT_UNDEFINED};
+    // last write, every later access has to wait for it
+    VkPipelineStageFlags2 writeStages{VK_PIPELINE_STAGE_2_NONE};
+    VkAccessFlags2 writeAccess{VK_ACCESS_2_NONE};
+    // accesses already made visible since the last write
+    VkPipelineStageFlags2 readStages{VK_PIPELINE_STAGE_2_NONE};
+    VkAccessFlags2 readAccess{VK_ACCESS_2_NONE};
+  };
+
+  struct Resource {
+    std::string name;
+    VkImage image{VK_NULL_HANDLE};
+    VkImageAspectFlags aspect{0};
+    VkBuffer buffer{VK_NULL_HANDLE};
+    // has to hold valid contents once the graph is done
+    bool exported{false};
+    std::optional<ResourceUsage> exportUsage;
+
+    bool transient{false};
+    VkImageCreateInfo imageInfo{};
+    // transients placed over the same memory
+    std::vector<ResourceId> aliases;
+  };
+
+  // memory of the transient images in the last compile
+  struct TransientMemory {
+    // the block they are all placed in
+    VkDeviceSize aliased;
+    // what they would take as one allocation each
+    VkDeviceSize dedicated;
+  };
+
+  struct Access {
+    ResourceId resource;
+    ResourceUsage usage;
+    bool write;
+    // the previous contents are not needed, images start from undefined
+    bool discard;
+  };
+
+  struct Pass {
+    std::string name;
+    std::vector<Access> accesses;
+    RecordFn record;
+    bool culled{false};
+  };
+
+  // declares the accesses of a pass, only valid until the next add_pass
+  struct PassBuilder {
+    Pass &pass;
+
+    PassBuilder &read(ResourceId resource, ResourceUsage usage);
+    // read-modify-write, keeps what earlier passes wrote
+    PassBuilder &write(ResourceId resource, ResourceUsage usage);
+    // replaces the whole contents
+    PassBuilder &overwrite(ResourceId resource, ResourceUsage usage);
+  };
+
+  std::vector<Resource> resources;
+  std::vector<Pass> passes;
+
+  // barrier statistics of the last execute, for the ui
+  uint32_t barrierBatches{0};
+  uint32_t imageBarriers{0};
+  uint32_t bufferBarriers{0};
+  uint32_t culledPasses{0};
+  TransientMemory transientMemory{};
+
+  // times every pass it records when set
+  GpuProfiler *profiler{nullptr};
+
+  void init(VkDevice device, VmaAllocator allocator);
+  // waits for the device, then frees the transient images
+  void destroy();
+
+  // clears the passes and resources of the last frame, keeps the states
+  void reset();
+
+  // entry overrides the remembered state, for images handed over from
+  // outside the queue like a freshly acquired swapchain image
+  ResourceId import_image(std::string name, VkImage image,
+                          VkImageAspectFlags aspect,
+                          std::optional<ResourceState> entry = {});
+  ResourceId import_buffer(std::string name, VkBuffer buffer);
+  // the image exists from compile() on, same name and info across frames
+  // keep the same image unless the memory layout changes
+  ResourceId create_image(std::string name, const VkImageCreateInfo &info,
+                          VkImageAspectFlags aspect);
+
+  // keeps the passes writing the resource alive and, with a usage, makes the
+  // graph end with a barrier towards it
+  void export_resource(ResourceId resource,
+                       std::optional<ResourceUsage> usage = {});
+
+  PassBuilder add_pass(std::string name, RecordFn record);
+
+  // culls the passes, then places the transient images by their lifetime.
+  // returns true when they had to be recreated, which waits for the device
+  // and invalidates every view of the old ones
+  bool compile();
+  // records the passes compile() kept, with their barriers
+  void execute(VkCommandBuffer cmd);
+
+private:
+  struct Transient {
+    VkImageCreateInfo info{};
+    VkMemoryRequirements requirements{};
+    VkImage image{VK_NULL_HANDLE};
+    VkDeviceSize offset{0};
+  };
+
+  struct Barriers {
+    std::vector<VkImageMemoryBarrier2> images;
+    std::vector<VkBufferMemoryBarrier2> buffers;
+  };
+
+  void cull_passes();
+  bool place_transients();
+  void free_transients();
+  void add_barrier(Barriers &barriers, ResourceId resource,
+                   const ResourceUsage &usage, bool write, bool discard);
+  void flush_barriers(VkCommandBuffer cmd, Barriers &barriers);
+
+  VkDevice _device{VK_NULL_HANDLE};
+  VmaAllocator _allocator{};
+
+  std::unordered_map<uint64_t, ResourceState> _states;
+  std::vector<ResourceState *> _current;
+  // first access of every resource this frame
+  std::vector<bool> _touched;
+
+  std::unordered_map<std::string, Transient> _transients;
+  VmaAllocation _transientMemory{};
+  VkDeviceSize _transientMemorySize{0};
+};
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <string_view>
+
+// scoped cpu zones of every thread, captured for a number of frames and
+// written as chrome trace event json, which chrome://tracing and
+// ui.perfetto.dev open. outside a capture a zone costs one relaxed load,
+// during one a clock read on each end and a push into a thread local buffer
+namespace cputrace {
+
+// captures the frames that follow the next end_frame(), then writes the
+// trace to path
+void begin_capture(uint32_t frames, std::filesystem::path path);
+// call between frames, starts and counts the capture
+void end_frame();
+// frames left in the running capture, 0 when there is none
+uint32_t remaining_frames();
+// shown instead of the thread number, the name has to outlive the trace
+void set_thread_name(const char *name);
+
+// appends text escaped for a json string, without the quotes. names are
+// identifiers in practice, this only keeps the json valid
+void append_json_escaped(std::string &out, std::string_view text);
+
+namespace detail {
+inline std::atomic<bool> capturing{false};
+
+inline int64_t now() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+void record(const char *name, int64_t start, int64_t end);
+} // namespace detail
+
+// the name has to outlive the capture, string literals are fine
+struct Zone {
+  const char *name;
+  // -1 outside a capture
+  int64_t start;
+
+  explicit Zone(const char *name)
+      : name(name), start(detail::capturing.load(std::memory_order_relaxed)
+                              ? detail::now()
+                              : -1) {}
+  ~Zone() {
+    if (start >= 0) {
+      detail::record(name, start, detail::now());
+    }
+  }
+
+  Zone(const Zone &) = delete;
+  Zone &operator=(const Zone &) = delete;
+};
+} // namespace cputrace
+
+#define CPU_ZONE_CONCAT_(a, b) a##b
+#define CPU_ZONE_CONCAT(a, b) CPU_ZONE_CONCAT_(a, b)
+// times the rest of the enclosing scope
+#define CPU_ZONE(name) cputrace::Zone CPU_ZONE_CONCAT(cpuZone, __LINE__){name}
@@ -43,12 +43,68 @@ struct Vertex {
   glm::vec4 color;
 };
 
-// holds the resources needed for a mesh
+// layouts a mesh can be stored in on the gpu. uploads take the float Vertex
+// and pack it, colored_triangle_mesh.slang has a vertex shader for each
+enum class VertexFormat : uint32_t {
+  // Vertex as is, 48 bytes
+  Float,
+  // PackedVertex, 24 bytes
+  Packed,
+  // QuantizedVertex, 20 bytes
+  Quantized,
+};
+
+// full precision position, octahedral normal in snorm16x2, half2 uv and
+// unorm8x4 color
+struct PackedVertex {
+  float position[3];
+  uint32_t normal;
+  uint32_t uv;
+  uint32_t color;
+};
+
+// same as PackedVertex but the position is unorm16 inside the bounds of the
+// mesh, see GPUMeshBuffers::positionScale
+struct QuantizedVertex {
+  uint16_t position[3];
+  uint16_t pad;
+  uint32_t normal;
+  uint32_t uv;
+  uint32_t color;
+};
+
+// holds the resources needed for a mesh: its ranges inside the engine's
+// geometry pool
 struct GPUMeshBuffers {
 
-  AllocatedBuffer indexBuffer;
-  AllocatedBuffer vertexBuffer;
+  // byte ranges inside the pool buffers
+  VkDeviceSize vertexOffset;
+  VkDeviceSize vertexSize;
+  VkDeviceSize indexOffset;
+  VkDeviceSize indexSize;
+
+  // index range to pass to vkCmdDrawIndexed, with the pool index buffer
+  // bound at offset 0 using indexType
+  uint32_t firstIndex;
+  uint32_t indexCount;
+  // 16 bit whenever every vertex can be addressed with it
+  VkIndexType indexType;
+
+  // address of the first vertex of the mesh
   VkDeviceAddress vertexBufferAddress;
+
+  // how the vertices are laid out. quantized positions decode to
+  // positionOffset + positionScale * q, which the draw folds into the world
+  // matrix. the other formats leave these at identity
+  VertexFormat vertexFormat;
+  glm::vec3 positionScale;
+  glm::vec3 positionOffset;
+};
+
+// cpu side data for one mesh in a batched upload
+struct MeshUploadInfo {
+  std::span<const uint32_t> indices;
+  std::span<const Vertex> vertices;
 };
 
 // push constants for our mesh object draws
@@ -56,3 +112,47 @@ struct GPUDrawPushConstants {
   glm::mat4 worldMatrix;
   VkDeviceAddress vertexBuffer;
 };
+
+// one drawable surface of the gpu driven scene, read by the culling pass and
+// the indirect vertex shaders. mirrored by ObjectData in cull.slang and
+// colored_triangle_mesh.slang, keep the three in sync
+struct GPUObjectData {
+  // model matrix with the dequantization of the mesh folded in
+  glm::mat4 renderMatrix;
+  // world space bounding sphere, center and radius
+  glm::vec4 sphereBounds;
+  uint32_t firstIndex;
+  uint32_t indexCount;
+  // which indirect command stream the draw goes to, one per index type
+  uint32_t drawBucket;
+  uint32_t pad0;
+  VkDeviceAddress vertexBuffer;
+  uint64_t pad1;
+};
+static_assert(sizeof(GPUObjectData) == 112, "must match the std430 stride");
+
+// push constants of the indirect scene draws
+struct GPUSceneDrawPushConstants {
+  glm::mat4 viewProj;
+  VkDeviceAddress objectBuffer;
+};
+
+// GPUCullPushConstants::flags
+enum GPUCullFlags : uint32_t {
+  CULL_FRUSTUM = 1,
+  CULL_OCCLUSION = 2,
+  // second occlusion phase, tests against the depth pyramid
+  CULL_LATE_PASS = 4,
+};
+
+// push constants of the culling pass
+struct GPUCullPushConstants {
+  // the frustum planes are extracted from it in the shader
+  glm::mat4 viewProj;
+  uint32_t objectCount;
+  // commands each draw bucket has room for
+  uint32_t bucketCapacity;
+  uint32_t flags;
+  uint32_t pad;
+  glm::vec2 pyramidSize;
+};
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <vk_types.h>
+
+// streams cpu data into device local buffers through a persistently mapped
+// staging ring, on the transfer queue when the device has one. copies are
+// batched until flush(), which returns the timeline semaphore value the
+// graphics queue has to wait on before reading the data
+struct UploadManager {
+  struct Submission {
+    VkCommandBuffer cmd;
+    uint64_t timelineValue;
+    // ring head once the copies of this submission retire
+    VkDeviceSize ringEnd;
+  };
+
+  VkDevice device;
+  VkQueue queue;
+  uint32_t queueFamily;
+
+  AllocatedBuffer ring;
+  char *ringData;
+  VkDeviceSize ringSize;
+  // monotonic byte counters, the ring offset is counter % ringSize
+  VkDeviceSize head;
+  VkDeviceSize tail;
+
+  VkSemaphore timeline;
+  uint64_t submittedValue;
+
+  VkCommandPool commandPool;
+  VkCommandBuffer recording;
+  std::deque<Submission> inFlight;
+  std::vector<VkCommandBuffer> freeCommandBuffers;
+
+  void init(VkDevice device, VmaAllocator allocator, VkQueue queue,
+            uint32_t queueFamily, VkDeviceSize size);
+  void destroy(VmaAllocator allocator);
+
+  // copies size bytes of data into dst, splitting uploads larger than the
+  // ring. only blocks when the ring is full of copies still in flight
+  void upload(VkBuffer dst, VkDeviceSize dstOffset, const void *data,
+              VkDeviceSize size);
+  // submits the recorded copies, returns the value they signal on completion
+  uint64_t flush();
+  void wait(uint64_t value);
+
+  VkDeviceSize reserve(VkDeviceSize size, VkDeviceSize *outOffset);
+  VkCommandBuffer begin_recording();
+  void retire();
+};
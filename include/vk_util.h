@@ -1 +1,11 @@
-#pragma once
\ No newline at end of file
+#pragma once
+#include <vulkan/vulkan.h>
+
+namespace vkutil {
+
+// global memory dependency, for buffers that are written and read by
+// different passes of the same queue
+void memory_barrier(VkCommandBuffer cmd, VkPipelineStageFlags2 srcStage,
+                    VkAccessFlags2 srcAccess, VkPipelineStageFlags2 dstStage,
+                    VkAccessFlags2 dstAccess);
+} // namespace vkutil
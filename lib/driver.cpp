@@ -5,9 +5,71 @@
 
 #include <vk_engine.h>
 
-int main() {
+#include <csignal>
+#include <cstdlib>
+#include <string_view>
+
+static VulkanEngine *runningEngine = nullptr;
+
+// lets ctrl-c end a headless run with its throughput printed
+static void handle_interrupt(int) {
+  if (runningEngine) {
+    runningEngine->request_stop();
+  }
+}
+
+static VkPresentModeKHR parse_present_mode(std::string_view name) {
+  if (name == "mailbox") {
+    return VK_PRESENT_MODE_MAILBOX_KHR;
+  }
+  if (name == "immediate") {
+    return VK_PRESENT_MODE_IMMEDIATE_KHR;
+  }
+  if (name == "fifo-relaxed") {
+    return VK_PRESENT_MODE_FIFO_RELAXED_KHR;
+  }
+  return VK_PRESENT_MODE_FIFO_KHR;
+}
+
+// spock [--frames-in-flight n]
+//       [--present-mode fifo|fifo-relaxed|mailbox|immediate] [--low-latency]
+//       [--cpu-trace frames] [--headless [frames]]
+//       [--capture frames [directory]] [--capture-raw]
+int main(int argc, char **argv) {
+  EngineOptions options;
+  for (int i = 1; i < argc; ++i) {
+    std::string_view arg{argv[i]};
+    bool hasValue = i + 1 < argc;
+    if (arg == "--frames-in-flight" && hasValue) {
+      options.framesInFlight = (uint32_t)std::atoi(argv[++i]);
+    } else if (arg == "--present-mode" && hasValue) {
+      options.presentMode = parse_present_mode(argv[++i]);
+    } else if (arg == "--low-latency") {
+      options.lowLatency = true;
+    } else if (arg == "--cpu-trace" && hasValue) {
+      options.cpuTraceFrames = (uint32_t)std::atoi(argv[++i]);
+    } else if (arg == "--capture" && hasValue) {
+      options.captureFrames = (uint32_t)std::atoi(argv[++i]);
+      if (i + 1 < argc && argv[i + 1][0] != '-') {
+        options.captureDirectory = argv[++i];
+      }
+    } else if (arg == "--capture-raw") {
+      options.captureRaw = true;
+    } else if (arg == "--headless") {
+      options.headless = true;
+      // the frame count is optional
+      if (hasValue && argv[i + 1][0] != '-') {
+        options.headlessFrames = (uint32_t)std::atoi(argv[++i]);
+      }
+    }
+  }
+
   VulkanEngine engine;
-  engine.init();
+  engine.init(options);
+  runningEngine = &engine;
+  std::signal(SIGINT, handle_interrupt);
   engine.run();
+  std::signal(SIGINT, SIG_DFL);
+  runningEngine = nullptr;
   engine.cleanup();
 }
\ No newline at end of file
@@ -0,0 +1,306 @@
+#include <vk_engine.h>
+#include <vk_loader.h>
+#include <vk_trace.h>
+
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <string>
+#include <string_view>
+
+namespace {
+struct BenchOptions {
+  uint32_t objects{10000};
+  // per unique mesh, rounded to what the sphere tessellation can hit
+  uint32_t triangles{2000};
+  uint32_t meshes{16};
+  uint32_t frames{512};
+  // rendered before measuring, lets pipelines and caches settle
+  uint32_t warmup{64};
+  uint64_t seed{1};
+  // the engine logs to stdout, so the json goes to a file
+  std::string output{"bench.json"};
+};
+
+// splitmix64, the same sequence on every platform unlike the std
+// distributions
+struct Random {
+  uint64_t state;
+
+  uint64_t next() {
+    uint64_t z = (state += 0x9e3779b97f4a7c15ull);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+    return z ^ (z >> 31);
+  }
+  // [0, 1)
+  float unit() { return (next() >> 40) / float(1ull << 24); }
+  float range(float lo, float hi) { return lo + (hi - lo) * unit(); }
+};
+
+struct SyntheticMesh {
+  std::vector<uint32_t> indices;
+  std::vector<Vertex> vertices;
+};
+
+// a sphere with a bumpy radius, 4 rings^2 triangles. every mesh gets its own
+// bumps and color so none of them are alike
+SyntheticMesh make_mesh(uint32_t triangles, Random &random) {
+  uint32_t rings =
+      std::max(2u, (uint32_t)std::lround(std::sqrt(triangles / 4.)));
+  uint32_t segments = rings * 2;
+
+  float frequencyA = std::floor(random.range(2, 8));
+  float frequencyB = std::floor(random.range(2, 8));
+  float phase = random.range(0, 6.2831853f);
+  glm::vec4 color{random.unit(), random.unit(), random.unit(), 1};
+
+  SyntheticMesh mesh;
+  for (uint32_t r = 0; r <= rings; ++r) {
+    float theta = 3.14159265f * r / rings;
+    for (uint32_t s = 0; s <= segments; ++s) {
+      float phi = 6.2831853f * s / segments;
+      glm::vec3 normal{std::sin(theta) * std::cos(phi), std::cos(theta),
+                       std::sin(theta) * std::sin(phi)};
+      float radius = 1.f + 0.15f * std::sin(frequencyA * theta + phase) *
+                               std::cos(frequencyB * phi);
+
+      Vertex vertex{};
+      vertex.position = normal * radius;
+      vertex.normal = normal;
+      vertex.uv_x = (float)s / segments;
+      vertex.uv_y = (float)r / rings;
+      vertex.color = color;
+      mesh.vertices.push_back(vertex);
+    }
+  }
+
+  uint32_t stride = segments + 1;
+  for (uint32_t r = 0; r < rings; ++r) {
+    for (uint32_t s = 0; s < segments; ++s) {
+      uint32_t a = r * stride + s;
+      uint32_t b = a + stride;
+      mesh.indices.insert(mesh.indices.end(), {a, b, a + 1, a + 1, b, b + 1});
+    }
+  }
+  return mesh;
+}
+
+// the loader computes these for gltf meshes, the culling needs them
+Bounds compute_bounds(const SyntheticMesh &mesh) {
+  glm::vec3 minpos = mesh.vertices[0].position;
+  glm::vec3 maxpos = minpos;
+  for (const Vertex &vertex : mesh.vertices) {
+    minpos = glm::min(minpos, vertex.position);
+    maxpos = glm::max(maxpos, vertex.position);
+  }
+
+  Bounds bounds{};
+  bounds.origin = (maxpos + minpos) / 2.f;
+  bounds.extents = (maxpos - minpos) / 2.f;
+  for (const Vertex &vertex : mesh.vertices) {
+    bounds.sphereRadius = std::max(
+        bounds.sphereRadius, glm::length(vertex.position - bounds.origin));
+  }
+  return bounds;
+}
+
+// one orbit around the grid over the measured frames, dipping up and down so
+// the amount of visible and occluded objects keeps changing
+glm::mat4 camera_view(float t, float gridSize) {
+  float angle = 6.2831853f * t;
+  float distance = gridSize * 0.9f + 5.f;
+  glm::vec3 eye{std::sin(angle) * distance,
+                std::sin(2 * angle) * gridSize * 0.25f,
+                std::cos(angle) * distance};
+  return glm::lookAt(eye, glm::vec3{0}, glm::vec3{0, 1, 0});
+}
+
+struct Summary {
+  double average;
+  double p50;
+  double p95;
+  double p99;
+  double min;
+  double max;
+};
+
+Summary summarize(std::vector<double> samples) {
+  std::sort(samples.begin(), samples.end());
+  double sum = 0;
+  for (double sample : samples) {
+    sum += sample;
+  }
+  return {.average = sum / samples.size(),
+          .p50 = GpuProfiler::percentile(samples, 0.50),
+          .p95 = GpuProfiler::percentile(samples, 0.95),
+          .p99 = GpuProfiler::percentile(samples, 0.99),
+          .min = samples.front(),
+          .max = samples.back()};
+}
+
+BenchOptions parse_options(int argc, char **argv) {
+  BenchOptions options;
+  for (int i = 1; i + 1 < argc; i += 2) {
+    std::string_view arg{argv[i]};
+    const char *value = argv[i + 1];
+    if (arg == "--objects") {
+      options.objects = (uint32_t)std::atoi(value);
+    } else if (arg == "--triangles") {
+      options.triangles = (uint32_t)std::atoi(value);
+    } else if (arg == "--meshes") {
+      options.meshes = (uint32_t)std::atoi(value);
+    } else if (arg == "--frames") {
+      options.frames = (uint32_t)std::atoi(value);
+    } else if (arg == "--warmup") {
+      options.warmup = (uint32_t)std::atoi(value);
+    } else if (arg == "--seed") {
+      options.seed = std::stoull(value);
+    } else if (arg == "--output") {
+      options.output = value;
+    } else {
+      fmt::println("Unknown option {}", arg);
+    }
+  }
+  options.objects = std::max(1u, options.objects);
+  options.meshes = std::max(1u, options.meshes);
+  options.frames = std::max(1u, options.frames);
+  return options;
+}
+} // namespace
+
+// renders a generated scene headless along a fixed camera path and writes
+// json with the cpu frame times, the gpu pass times and the memory in use.
+// the same options give the same scene and frames on every run
+//
+// spock_bench [--objects n] [--triangles n] [--meshes n] [--frames n]
+//             [--warmup n] [--seed n] [--output file.json]
+int main(int argc, char **argv) {
+  BenchOptions options = parse_options(argc, argv);
+
+  VulkanEngine engine;
+  engine.init({.headless = true, .defaultScene = false, .validation = false});
+
+  Random random{options.seed};
+  std::vector<SyntheticMesh> meshes;
+  std::vector<MeshUploadInfo> uploads;
+  for (uint32_t i = 0; i < options.meshes; ++i) {
+    meshes.push_back(make_mesh(options.triangles, random));
+  }
+  for (const SyntheticMesh &mesh : meshes) {
+    uploads.push_back({.indices = mesh.indices, .vertices = mesh.vertices});
+  }
+  std::vector<GPUMeshBuffers> buffers = engine.uploadMeshes(uploads);
+
+  std::vector<MeshAsset> assets(meshes.size());
+  for (size_t i = 0; i < meshes.size(); ++i) {
+    assets[i].name = fmt::format("synthetic {}", i);
+    assets[i].meshBuffers = buffers[i];
+    assets[i].surfaces.push_back({.startIndex = 0,
+                                  .count = (uint32_t)meshes[i].indices.size(),
+                                  .bounds = compute_bounds(meshes[i])});
+  }
+
+  // a cube of objects around the origin, each turned and scaled its own way
+  constexpr float SPACING = 3.f;
+  uint32_t side = (uint32_t)std::ceil(std::cbrt((double)options.objects));
+  float gridSize = side * SPACING;
+  std::vector<SceneInstance> instances;
+  for (uint32_t i = 0; i < options.objects; ++i) {
+    glm::vec3 cell{(float)(i % side), (float)(i / side % side),
+                   (float)(i / (side * side))};
+    glm::vec3 position = (cell - (side - 1) / 2.f) * SPACING;
+    glm::vec3 axis = glm::normalize(glm::vec3{
+        random.range(-1, 1), random.range(-1, 1), random.range(-1, 1) + 2});
+    glm::mat4 transform = glm::translate(glm::mat4{1.f}, position);
+    transform = glm::rotate(transform, random.range(0, 6.2831853f), axis);
+    transform = glm::scale(transform, glm::vec3{random.range(0.5f, 1.f)});
+    uint32_t mesh = (uint32_t)(random.next() % assets.size());
+    instances.push_back({.mesh = &assets[mesh], .transform = transform});
+  }
+  engine.set_scene(instances);
+
+  for (uint32_t i = 0; i < options.warmup; ++i) {
+    engine.set_camera(camera_view(0, gridSize));
+    engine.draw();
+  }
+
+  std::vector<double> frameMilliseconds;
+  auto start = std::chrono::steady_clock::now();
+  for (uint32_t i = 0; i < options.frames; ++i) {
+    engine.set_camera(camera_view((float)i / options.frames, gridSize));
+    auto frameStart = std::chrono::steady_clock::now();
+    engine.draw();
+    frameMilliseconds.push_back(
+        std::chrono::duration<double, std::milli>(
+            std::chrono::steady_clock::now() - frameStart)
+            .count());
+  }
+  double seconds =
+      std::chrono::duration<double>(std::chrono::steady_clock::now() - start)
+          .count();
+
+  Summary cpu = summarize(frameMilliseconds);
+  uint64_t triangles = 0;
+  for (const SceneInstance &instance : instances) {
+    triangles += instance.mesh->surfaces[0].count / 3;
+  }
+
+  std::string json = "{\n";
+  json += fmt::format("  \"scene\": {{\"objects\": {}, \"uniqueMeshes\": {}, "
+                      "\"trianglesPerMesh\": {}, \"triangles\": {}, "
+                      "\"seed\": {}}},\n",
+                      options.objects, options.meshes,
+                      assets[0].surfaces[0].count / 3, triangles,
+                      options.seed);
+  json += fmt::format("  \"frames\": {}, \"warmupFrames\": {}, "
+                      "\"framesPerSecond\": {:.2f},\n",
+                      options.frames, options.warmup,
+                      options.frames / seconds);
+  json += fmt::format("  \"cpuFrameMs\": {{\"average\": {:.4f}, \"p50\": "
+                      "{:.4f}, \"p95\": {:.4f}, \"p99\": {:.4f}, \"min\": "
+                      "{:.4f}, \"max\": {:.4f}}},\n",
+                      cpu.average, cpu.p50, cpu.p95, cpu.p99, cpu.min,
+                      cpu.max);
+
+  // the profiler keeps the last GpuProfiler::HISTORY_SIZE frames per pass
+  json += "  \"gpuPassMs\": [";
+  bool first = true;
+  for (const GpuProfiler::ScopeStats &pass : engine.gpu_pass_stats()) {
+    json += fmt::format("{}\n    {{\"name\": \"", first ? "" : ",");
+    cputrace::append_json_escaped(json, pass.name);
+    json += fmt::format("\", \"samples\": {}, \"average\": {:.4f}, \"p50\": "
+                        "{:.4f}, \"p95\": {:.4f}, \"p99\": {:.4f}}}",
+                        pass.samples, pass.average, pass.p50, pass.p95,
+                        pass.p99);
+    first = false;
+  }
+  json += "\n  ],\n";
+
+  json += "  \"memoryHeaps\": [";
+  first = true;
+  for (const MemoryHeapUsage &heap : engine.memory_usage()) {
+    json += fmt::format("{}\n    {{\"deviceLocal\": {}, \"allocationBytes\": "
+                        "{}, \"usageBytes\": {}, \"budgetBytes\": {}}}",
+                        first ? "" : ",", heap.deviceLocal,
+                        heap.allocationBytes, heap.usageBytes,
+                        heap.budgetBytes);
+    first = false;
+  }
+  json += "\n  ]\n}\n";
+
+  engine.cleanup();
+
+  std::ofstream file(options.output, std::ios::binary | std::ios::trunc);
+  file.write(json.data(), json.size());
+  if (!file) {
+    fmt::println("Failed to write {}", options.output);
+    return 1;
+  }
+  fmt::println("Wrote {}", options.output);
+  return 0;
+}
@@ -0,0 +1,90 @@
+#include <vk_jobs.h>
+
+#include <fmt/core.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <string>
+
+namespace {
+constexpr int REPEATS = 5;
+
+// best of REPEATS runs, in nanoseconds per item
+template <typename F> double measure(size_t items, F &&f) {
+  double best = 1e30;
+  for (int r = 0; r < REPEATS; ++r) {
+    auto start = std::chrono::steady_clock::now();
+    f();
+    auto end = std::chrono::steady_clock::now();
+    double ns = std::chrono::duration<double, std::nano>(end - start).count();
+    best = std::min(best, ns / (double)items);
+  }
+  return best;
+}
+
+// small fixed amount of work, kept alive through the sink
+float work(size_t i) {
+  float x = (float)i;
+  for (int k = 0; k < 64; ++k) {
+    x = std::sqrt(x * x + 1.f);
+  }
+  return x;
+}
+} // namespace
+
+// measures what scheduling costs on top of the jobs themselves
+int main(int argc, char **argv) {
+  unsigned workers = argc > 1 ? (unsigned)std::atoi(argv[1]) : 0;
+  size_t count = argc > 2 ? std::stoull(argv[2]) : 100000;
+
+  JobSystem jobs{workers};
+  fmt::println("{} workers, {} items", jobs.worker_count(), count);
+
+  std::vector<float> sink(count);
+
+  double empty = measure(count, [&]() {
+    std::vector<JobHandle> handles;
+    handles.reserve(count);
+    for (size_t i = 0; i < count; ++i) {
+      handles.push_back(jobs.schedule([]() {}));
+    }
+    for (const JobHandle &handle : handles) {
+      jobs.wait(handle);
+    }
+  });
+  fmt::println("schedule + wait, empty job: {:8.1f} ns/job", empty);
+
+  // every job depends on the previous one, nothing runs in parallel
+  size_t chainLength = std::min<size_t>(count, 10000);
+  double chain = measure(chainLength, [&]() {
+    JobHandle previous;
+    for (size_t i = 0; i < chainLength; ++i) {
+      previous = jobs.schedule([]() {}, {&previous, previous ? 1u : 0u});
+    }
+    jobs.wait(previous);
+  });
+  fmt::println("dependency chain:           {:8.1f} ns/job", chain);
+
+  double serial = measure(count, [&]() {
+    for (size_t i = 0; i < count; ++i) {
+      sink[i] = work(i);
+    }
+  });
+  fmt::println("serial loop:                {:8.1f} ns/item", serial);
+
+  for (size_t grain : {size_t(0), size_t(1), size_t(64), size_t(1024)}) {
+    double parallel = measure(count, [&]() {
+      jobs.wait(jobs.parallel_for(count, grain, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+          sink[i] = work(i);
+        }
+      }));
+    });
+    fmt::println("parallel_for, grain {:5}:   {:8.1f} ns/item ({:.2f}x)",
+                 grain, parallel, serial / parallel);
+  }
+
+  return 0;
+}
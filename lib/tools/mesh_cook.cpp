@@ -0,0 +1,16 @@
+#include <vk_loader.h>
+
+int main(int argc, char **argv) {
+  if (argc < 2) {
+    fmt::println("usage: spock_cook <file.glb>...");
+    return 1;
+  }
+
+  int failures = 0;
+  for (int i = 1; i < argc; ++i) {
+    if (!cookGltfMeshes(argv[i])) {
+      ++failures;
+    }
+  }
+  return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,233 @@
+#include "vk_capture.h"
+
+#include <vk_trace.h>
+
+#include <glm/common.hpp>
+#include <glm/packing.hpp>
+#include <stb_image_write.h>
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+
+namespace {
+// the formats the png conversion understands
+VkDeviceSize texel_bytes(VkFormat format) {
+  switch (format) {
+  case VK_FORMAT_R16G16B16A16_SFLOAT:
+    return 8;
+  case VK_FORMAT_R8G8B8A8_UNORM:
+    return 4;
+  default:
+    return 0;
+  }
+}
+} // namespace
+
+void FrameCapture::init(VmaAllocator allocator, VkExtent3D extent,
+                        VkFormat format, uint32_t frameCount,
+                        unsigned writerCount) {
+  _allocator = allocator;
+  _extent = extent;
+  _format = format;
+  if (texel_bytes(format) == 0) {
+    fmt::println("Frame capture does not support {}", string_VkFormat(format));
+    abort();
+  }
+  _frameBytes = texel_bytes(format) * extent.width * extent.height;
+
+  // written by the gpu, read by the cpu once the frame is done
+  VkBufferCreateInfo bufferInfo = {.sType =
+                                       VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO};
+  bufferInfo.size = _frameBytes;
+  bufferInfo.usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+
+  VmaAllocationCreateInfo vmaallocInfo = {};
+  vmaallocInfo.usage = VMA_MEMORY_USAGE_GPU_TO_CPU;
+  vmaallocInfo.flags = VMA_ALLOCATION_CREATE_MAPPED_BIT;
+
+  _slots.resize(frameCount);
+  for (Slot &slot : _slots) {
+    VK_CHECK(vmaCreateBuffer(_allocator, &bufferInfo, &vmaallocInfo,
+                             &slot.buffer.buffer, &slot.buffer.allocation,
+                             &slot.buffer.info));
+  }
+
+  // fast deflate, the writers have to keep up with the frame rate
+  stbi_write_png_compression_level = 1;
+
+  if (writerCount == 0) {
+    writerCount = std::max(1u, std::thread::hardware_concurrency() / 4);
+  }
+  for (unsigned i = 0; i < writerCount; ++i) {
+    _writers.emplace_back([this]() { writer_main(); });
+  }
+}
+
+void FrameCapture::destroy() {
+  for (Slot &slot : _slots) {
+    collect(slot);
+  }
+
+  {
+    std::lock_guard lock{_mutex};
+    _stopping = true;
+  }
+  _jobAdded.notify_all();
+  for (std::thread &writer : _writers) {
+    writer.join();
+  }
+  _writers.clear();
+
+  for (Slot &slot : _slots) {
+    vmaDestroyBuffer(_allocator, slot.buffer.buffer, slot.buffer.allocation);
+  }
+  _slots.clear();
+}
+
+void FrameCapture::begin(uint32_t frames, std::filesystem::path directory,
+                         Format format) {
+  std::error_code error;
+  std::filesystem::create_directories(directory, error);
+  if (error) {
+    fmt::println("Failed to create {}: {}", directory.string(),
+                 error.message());
+    return;
+  }
+
+  _remaining = frames;
+  _nextIndex = 0;
+  _directory = std::move(directory);
+  _captureFormat = format;
+  fmt::println("Capturing {} frames of {}x{} to {}", frames, _extent.width,
+               _extent.height, _directory.string());
+}
+
+size_t FrameCapture::queued() {
+  std::lock_guard lock{_mutex};
+  return _jobs.size() + _writing;
+}
+
+void FrameCapture::begin_frame(uint32_t frameIndex) {
+  _current = frameIndex;
+  collect(_slots[frameIndex]);
+}
+
+VkBuffer FrameCapture::capture_frame() {
+  if (_remaining == 0) {
+    return VK_NULL_HANDLE;
+  }
+  --_remaining;
+
+  Slot &slot = _slots[_current];
+  slot.path = _directory / fmt::format("frame_{:05}.{}", _nextIndex++,
+                                       _captureFormat == Format::Png ? "png"
+                                                                     : "raw");
+  slot.format = _captureFormat;
+  return slot.buffer.buffer;
+}
+
+void FrameCapture::record_copy(VkCommandBuffer cmd, VkImage image) {
+  VkBufferImageCopy2 region{.sType = VK_STRUCTURE_TYPE_BUFFER_IMAGE_COPY_2};
+  region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+  region.imageSubresource.layerCount = 1;
+  region.imageExtent = _extent;
+
+  VkCopyImageToBufferInfo2 copyInfo{
+      .sType = VK_STRUCTURE_TYPE_COPY_IMAGE_TO_BUFFER_INFO_2};
+  copyInfo.srcImage = image;
+  copyInfo.srcImageLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+  copyInfo.dstBuffer = _slots[_current].buffer.buffer;
+  copyInfo.regionCount = 1;
+  copyInfo.pRegions = &region;
+
+  vkCmdCopyImageToBuffer2(cmd, &copyInfo);
+}
+
+void FrameCapture::collect(Slot &slot) {
+  if (slot.path.empty()) {
+    return;
+  }
+
+  Job job{.path = std::move(slot.path), .format = slot.format};
+  slot.path.clear();
+
+  // copied out so the buffer is free for the next frame right away, reading
+  // it in place would hold the frame until the writer is done
+  vmaInvalidateAllocation(_allocator, slot.buffer.allocation, 0,
+                          VK_WHOLE_SIZE);
+  {
+    CPU_ZONE("copy readback");
+    const auto *data = (const uint8_t *)slot.buffer.info.pMappedData;
+    job.pixels.assign(data, data + _frameBytes);
+  }
+
+  std::unique_lock lock{_mutex};
+  if (_jobs.size() >= MAX_QUEUED_FRAMES) {
+    CPU_ZONE("wait for capture writers");
+    _jobTaken.wait(lock,
+                   [this]() { return _jobs.size() < MAX_QUEUED_FRAMES; });
+  }
+  _jobs.push_back(std::move(job));
+  lock.unlock();
+  _jobAdded.notify_one();
+}
+
+void FrameCapture::writer_main() {
+  cputrace::set_thread_name("capture writer");
+
+  std::unique_lock lock{_mutex};
+  while (true) {
+    _jobAdded.wait(lock, [this]() { return _stopping || !_jobs.empty(); });
+    // the pending jobs are written before stopping
+    if (_jobs.empty()) {
+      return;
+    }
+
+    Job job = std::move(_jobs.front());
+    _jobs.pop_front();
+    ++_writing;
+    lock.unlock();
+    _jobTaken.notify_one();
+
+    write(job);
+
+    lock.lock();
+    --_writing;
+  }
+}
+
+void FrameCapture::write(const Job &job) {
+  bool written;
+  if (job.format == Format::Raw) {
+    CPU_ZONE("write raw frame");
+    std::ofstream file(job.path, std::ios::binary | std::ios::trunc);
+    file.write((const char *)job.pixels.data(), job.pixels.size());
+    written = (bool)file;
+  } else {
+    CPU_ZONE("encode png frame");
+    uint32_t pixelCount = _extent.width * _extent.height;
+    std::vector<uint8_t> rgb(pixelCount * 3);
+    for (uint32_t i = 0; i < pixelCount; ++i) {
+      for (uint32_t c = 0; c < 3; ++c) {
+        float value;
+        if (_format == VK_FORMAT_R16G16B16A16_SFLOAT) {
+          uint16_t half;
+          memcpy(&half, &job.pixels[(i * 4 + c) * 2], sizeof(half));
+          value = glm::unpackHalf1x16(half);
+        } else {
+          value = job.pixels[i * 4 + c] / 255.f;
+        }
+        value = glm::clamp(value, 0.f, 1.f);
+        rgb[i * 3 + c] = (uint8_t)(value * 255.f + 0.5f);
+      }
+    }
+    written = stbi_write_png(job.path.string().c_str(), _extent.width,
+                             _extent.height, 3, rgb.data(),
+                             _extent.width * 3) != 0;
+  }
+
+  if (!written) {
+    fmt::println("Failed to write {}", job.path.string());
+  }
+}
@@ -0,0 +1,219 @@
+#include "vk_culling.h"
+
+#include <vk_jobs.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+
+#include <glm/geometric.hpp>
+
+#if defined(__SSE2__) || defined(_M_X64) ||                                   \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define SPOCK_CULL_SSE
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#define SPOCK_CULL_NEON
+#include <arm_neon.h>
+#endif
+
+Frustum make_frustum(const glm::mat4 &viewProj) {
+  // glm is column major, pull out the rows of the matrix
+  glm::vec4 row[4];
+  for (int i = 0; i < 4; ++i) {
+    row[i] = {viewProj[0][i], viewProj[1][i], viewProj[2][i], viewProj[3][i]};
+  }
+
+  Frustum frustum;
+  frustum.planes[0] = row[3] + row[0]; // left
+  frustum.planes[1] = row[3] - row[0]; // right
+  frustum.planes[2] = row[3] + row[1]; // bottom
+  frustum.planes[3] = row[3] - row[1]; // top
+  frustum.planes[4] = row[2];          // z >= 0
+  frustum.planes[5] = row[3] - row[2]; // z <= w
+
+  // normalize so sphere radii can be compared against the distances
+  for (glm::vec4 &plane : frustum.planes) {
+    plane /= glm::length(glm::vec3{plane});
+  }
+  return frustum;
+}
+
+void CullingBounds::clear() {
+  for (auto *v : {&centerX, &centerY, &centerZ, &radius, &extentX, &extentY,
+                  &extentZ}) {
+    v->clear();
+  }
+}
+
+void CullingBounds::push_back(glm::vec3 center, float sphereRadius,
+                              glm::vec3 extents) {
+  centerX.push_back(center.x);
+  centerY.push_back(center.y);
+  centerZ.push_back(center.z);
+  radius.push_back(sphereRadius);
+  extentX.push_back(extents.x);
+  extentY.push_back(extents.y);
+  extentZ.push_back(extents.z);
+}
+
+namespace {
+bool is_visible(const Frustum &frustum, const CullingBounds &b, size_t i) {
+  for (const glm::vec4 &p : frustum.planes) {
+    float dist = p.x * b.centerX[i] + p.y * b.centerY[i] +
+                 p.z * b.centerZ[i] + p.w;
+    float boxRadius = std::abs(p.x) * b.extentX[i] +
+                      std::abs(p.y) * b.extentY[i] +
+                      std::abs(p.z) * b.extentZ[i];
+    if (dist < -b.radius[i] || dist < -boxRadius) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// tests objects [begin, end) four at a time while a full register remains,
+// returns where it stopped
+size_t cull_simd(const Frustum &frustum, const CullingBounds &b, size_t begin,
+                 size_t end, std::vector<uint32_t> &visible) {
+  size_t count = begin + ((end - begin) & ~size_t(3));
+
+#if defined(SPOCK_CULL_SSE)
+  const __m128 zero = _mm_setzero_ps();
+  for (size_t i = begin; i < count; i += 4) {
+    __m128 cx = _mm_loadu_ps(&b.centerX[i]);
+    __m128 cy = _mm_loadu_ps(&b.centerY[i]);
+    __m128 cz = _mm_loadu_ps(&b.centerZ[i]);
+    __m128 r = _mm_loadu_ps(&b.radius[i]);
+    __m128 ex = _mm_loadu_ps(&b.extentX[i]);
+    __m128 ey = _mm_loadu_ps(&b.extentY[i]);
+    __m128 ez = _mm_loadu_ps(&b.extentZ[i]);
+
+    __m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+    for (const glm::vec4 &p : frustum.planes) {
+      __m128 dist = _mm_add_ps(
+          _mm_add_ps(_mm_mul_ps(_mm_set1_ps(p.x), cx),
+                     _mm_mul_ps(_mm_set1_ps(p.y), cy)),
+          _mm_add_ps(_mm_mul_ps(_mm_set1_ps(p.z), cz), _mm_set1_ps(p.w)));
+      __m128 boxRadius = _mm_add_ps(
+          _mm_add_ps(_mm_mul_ps(_mm_set1_ps(std::abs(p.x)), ex),
+                     _mm_mul_ps(_mm_set1_ps(std::abs(p.y)), ey)),
+          _mm_mul_ps(_mm_set1_ps(std::abs(p.z)), ez));
+
+      __m128 sphereIn = _mm_cmpge_ps(_mm_add_ps(dist, r), zero);
+      __m128 boxIn = _mm_cmpge_ps(_mm_add_ps(dist, boxRadius), zero);
+      inside = _mm_and_ps(inside, _mm_and_ps(sphereIn, boxIn));
+    }
+
+    int mask = _mm_movemask_ps(inside);
+    for (int lane = 0; lane < 4; ++lane) {
+      if (mask & (1 << lane)) {
+        visible.push_back((uint32_t)(i + lane));
+      }
+    }
+  }
+  return count;
+#elif defined(SPOCK_CULL_NEON)
+  for (size_t i = begin; i < count; i += 4) {
+    float32x4_t cx = vld1q_f32(&b.centerX[i]);
+    float32x4_t cy = vld1q_f32(&b.centerY[i]);
+    float32x4_t cz = vld1q_f32(&b.centerZ[i]);
+    float32x4_t r = vld1q_f32(&b.radius[i]);
+    float32x4_t ex = vld1q_f32(&b.extentX[i]);
+    float32x4_t ey = vld1q_f32(&b.extentY[i]);
+    float32x4_t ez = vld1q_f32(&b.extentZ[i]);
+
+    uint32x4_t inside = vdupq_n_u32(~0u);
+    for (const glm::vec4 &p : frustum.planes) {
+      float32x4_t dist = vdupq_n_f32(p.w);
+      dist = vmlaq_n_f32(dist, cx, p.x);
+      dist = vmlaq_n_f32(dist, cy, p.y);
+      dist = vmlaq_n_f32(dist, cz, p.z);
+
+      float32x4_t boxRadius = vmulq_n_f32(ex, std::abs(p.x));
+      boxRadius = vmlaq_n_f32(boxRadius, ey, std::abs(p.y));
+      boxRadius = vmlaq_n_f32(boxRadius, ez, std::abs(p.z));
+
+      float32x4_t zero = vdupq_n_f32(0.f);
+      inside = vandq_u32(inside, vcgeq_f32(vaddq_f32(dist, r), zero));
+      inside = vandq_u32(inside, vcgeq_f32(vaddq_f32(dist, boxRadius), zero));
+    }
+
+    uint32_t lanes[4];
+    vst1q_u32(lanes, inside);
+    for (int lane = 0; lane < 4; ++lane) {
+      if (lanes[lane]) {
+        visible.push_back((uint32_t)(i + lane));
+      }
+    }
+  }
+  return count;
+#else
+  (void)frustum;
+  (void)visible;
+  (void)count;
+  return begin;
+#endif
+}
+
+void cull_range(const Frustum &frustum, const CullingBounds &bounds,
+                size_t begin, size_t end, std::vector<uint32_t> &visible) {
+  // the remainder that does not fill a register goes through the scalar test
+  for (size_t i = cull_simd(frustum, bounds, begin, end, visible); i < end;
+       ++i) {
+    if (is_visible(frustum, bounds, i)) {
+      visible.push_back((uint32_t)i);
+    }
+  }
+}
+
+// objects per culling job, a multiple of four so only the last chunk has a
+// scalar tail
+constexpr size_t CULL_CHUNK_SIZE = 1024;
+} // namespace
+
+CullingStats cull_frustum(const Frustum &frustum, const CullingBounds &bounds,
+                          std::vector<uint32_t> &visible) {
+  auto start = std::chrono::steady_clock::now();
+
+  visible.clear();
+  cull_range(frustum, bounds, 0, bounds.size(), visible);
+
+  auto end = std::chrono::steady_clock::now();
+  return {
+      .tested = (uint32_t)bounds.size(),
+      .visible = (uint32_t)visible.size(),
+      .milliseconds =
+          std::chrono::duration<double, std::milli>(end - start).count(),
+  };
+}
+
+CullingStats cull_frustum(const Frustum &frustum, const CullingBounds &bounds,
+                          std::vector<uint32_t> &visible, JobSystem &jobs) {
+  auto start = std::chrono::steady_clock::now();
+
+  // every chunk collects into its own list, joined in chunk order afterwards
+  size_t chunks = (bounds.size() + CULL_CHUNK_SIZE - 1) / CULL_CHUNK_SIZE;
+  std::vector<std::vector<uint32_t>> chunkVisible(chunks);
+  jobs.wait(jobs.parallel_for(
+      chunks, 1, [&](size_t firstChunk, size_t lastChunk) {
+        for (size_t c = firstChunk; c < lastChunk; ++c) {
+          size_t begin = c * CULL_CHUNK_SIZE;
+          size_t end = std::min(begin + CULL_CHUNK_SIZE, bounds.size());
+          cull_range(frustum, bounds, begin, end, chunkVisible[c]);
+        }
+      }));
+
+  visible.clear();
+  for (const std::vector<uint32_t> &chunk : chunkVisible) {
+    visible.insert(visible.end(), chunk.begin(), chunk.end());
+  }
+
+  auto end = std::chrono::steady_clock::now();
+  return {
+      .tested = (uint32_t)bounds.size(),
+      .visible = (uint32_t)visible.size(),
+      .milliseconds =
+          std::chrono::duration<double, std::milli>(end - start).count(),
+  };
+}
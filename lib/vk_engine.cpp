@@ -1,12 +1,21 @@
 
 #include "vk_engine.h"
 
+#include <vk_capture.h>
+#include <vk_culling.h>
 #include <vk_descriptors.h>
+#include <vk_geometry.h>
 #include <vk_images.h>
 #include <vk_initializers.h>
+#include <vk_jobs.h>
 #include <vk_loader.h>
 #include <vk_pipelines.h>
+#include <vk_profiler.h>
+#include <vk_rendergraph.h>
+#include <vk_trace.h>
 #include <vk_types.h>
+#include <vk_upload.h>
+#include <vk_util.h>
 
 #include "VkBootstrap.h"
 #define GLM_FORCE_DEPTH_ZERO_TO_ONE
@@ -16,9 +25,13 @@
 #include "imgui_impl_vulkan.h"
 
 #include "vk_mem_alloc.h"
+#include <algorithm>
 #include <array>
+#include <atomic>
 #include <chrono>
+#include <numeric>
 #include <thread>
+#include <unordered_map>
 
 struct DeletionQueue {
   std::deque<std::function<void()>> deletors;
@@ -39,16 +52,37 @@ struct DeletionQueue {
 
 //> framedata
 struct FrameData {
+  // the swapchain only signals binary semaphores
   VkSemaphore _swapchainSemaphore;
-  VkFence _renderFence;
+  // value of the graphics timeline the last submit of this frame signals
+  uint64_t _timelineValue{0};
 
   VkCommandPool _commandPool;
   VkCommandBuffer _mainCommandBuffer;
 
+  // background effect, submitted to the compute queue ahead of the frame
+  VkCommandPool _computePool;
+  VkCommandBuffer _computeCommandBuffer;
+
+  // one pool and secondary command buffer per recording thread, the last one
+  // belongs to the main thread. pools are not thread safe, so each thread
+  // only ever touches its own
+  std::vector<VkCommandPool> _recordPools;
+  std::vector<VkCommandBuffer> _recordCommandBuffers;
+
+  // draw commands written by the cpu culling path, bucket b starts at
+  // b * object count. one count per bucket
+  AllocatedBuffer _indirectBuffer;
+  uint32_t _indirectDrawCounts[2];
+  // copy of the draw counts of each gpu culling pass, read back once the
+  // frame is done
+  AllocatedBuffer _cullStatsBuffer;
+  uint32_t _cullStatsPasses;
+
   DeletionQueue _deletionQueue;
 };
 
-constexpr unsigned int FRAME_OVERLAP = 2;
+constexpr uint32_t MAX_FRAMES_IN_FLIGHT = 4;
 //< framedata
 
 struct AllocatedImage {
@@ -76,15 +110,80 @@ struct ComputeEffect {
 };
 
 //> init_fn
-constexpr bool bUseValidationLayers = true;
+// size of the shared vertex and index buffers every mesh is placed in
+constexpr VkDeviceSize GEOMETRY_POOL_VERTEX_BYTES = 256ull * 1024 * 1024;
+constexpr VkDeviceSize GEOMETRY_POOL_INDEX_BYTES = 64ull * 1024 * 1024;
+// persistently mapped staging ring used for every upload
+constexpr VkDeviceSize UPLOAD_RING_BYTES = 64ull * 1024 * 1024;
+
+// pipeline cache blob, loaded at startup and written back on shutdown
+constexpr const char *PIPELINE_CACHE_PATH = "pipeline_cache.bin";
+// cpu zones of the captured frames, chrome trace event json
+constexpr const char *CPU_TRACE_PATH = "cpu_trace.json";
+// directory the frames captured from the ui are written to
+constexpr const char *CAPTURE_DIRECTORY = "captures";
+
+// layout meshes are packed into on upload
+constexpr VertexFormat VERTEX_FORMAT = VertexFormat::Packed;
+
+// vertex shader decoding each vertex format
+static const char *mesh_vertex_shader(VertexFormat format) {
+  switch (format) {
+  case VertexFormat::Packed:
+    return "shaders/colored_triangle_mesh_packed.vert.spv";
+  case VertexFormat::Quantized:
+    return "shaders/colored_triangle_mesh_quantized.vert.spv";
+  default:
+    return "shaders/colored_triangle_mesh.vert.spv";
+  }
+}
+
+// same, for the gpu driven draws that find their object by instance index
+static const char *indirect_vertex_shader(VertexFormat format) {
+  switch (format) {
+  case VertexFormat::Packed:
+    return "shaders/colored_triangle_mesh_indirect_packed.vert.spv";
+  case VertexFormat::Quantized:
+    return "shaders/colored_triangle_mesh_indirect_quantized.vert.spv";
+  default:
+    return "shaders/colored_triangle_mesh_indirect.vert.spv";
+  }
+}
+
+// the test scene is a cube of SCENE_GRID_SIZE^3 copies of the test meshes
+// behind the one at the origin
+constexpr int SCENE_GRID_SIZE = 16;
+constexpr float SCENE_GRID_SPACING = 3.f;
+// indirect command streams, one per index type since each needs its own
+// index buffer binding
+constexpr uint32_t DRAW_BUCKET_COUNT = 2;
+
+static uint32_t draw_bucket(VkIndexType type) {
+  return type == VK_INDEX_TYPE_UINT16 ? 0 : 1;
+}
+
+// shader modules shared by every pipeline, keyed by spir-v path
+using ShaderModules = std::unordered_map<std::string, VkShaderModule>;
+// pipeline creations that are compiled concurrently by init_pipelines
+using PipelineBuilds = std::vector<std::function<void()>>;
 
 struct VulkanEngine::impl {
   VulkanEngine *_parent{};
   bool _isInitialized{false};
+
+  // shared by asset loading, pipeline builds, culling and command recording.
+  // declared first so it outlives everything that schedules on it
+  JobSystem _jobs;
   int _frameNumber{0};
 
   bool stop_rendering{false};
 
+  // renders into the draw image only, for _headlessFrames frames or until
+  // request_stop(), 0 meaning the latter
+  bool _headless{false};
+  uint32_t _headlessFrames{0};
+  std::atomic<bool> _stopRequested{false};
+
   VkExtent2D _windowExtent{800, 450};
 
   GLFWwindow *_window{};
@@ -98,14 +197,42 @@ struct VulkanEngine::impl {
                                              //< inst_init
 
   //> queues
-  FrameData _frames[FRAME_OVERLAP];
+  // one per frame in flight
+  std::vector<FrameData> _frames;
 
   FrameData &get_current_frame() {
-    return _frames[_frameNumber % FRAME_OVERLAP];
+    return _frames[_frameNumber % _frames.size()];
   };
 
   VkQueue _graphicsQueue;
   uint32_t _graphicsQueueFamily;
+  // signaled by every frame submit, the cpu waits on it before reusing the
+  // frame's resources
+  VkSemaphore _graphicsTimeline;
+  uint64_t _graphicsTimelineValue{0};
+  // time draw() spent waiting for it and the time between frames, the two
+  // sides of the frames in flight tradeoff
+  double _frameWaitMilliseconds{0};
+  double _frameMilliseconds{0};
+  std::chrono::steady_clock::time_point _lastFrameStart;
+
+  // uploads go through this queue, which is the graphics queue when the
+  // device has no separate transfer family
+  VkQueue _transferQueue;
+  uint32_t _transferQueueFamily;
+  // families that device local buffers filled by uploads are shared between
+  std::vector<uint32_t> _sharedQueueFamilies;
+
+  // with a compute family besides graphics the background effect of a frame
+  // runs there, next to the graphics work of the frame before it. the draw
+  // image is handed over to graphics once it is written
+  VkQueue _computeQueue;
+  uint32_t _computeQueueFamily;
+  bool _asyncComputeAvailable{false};
+  bool _asyncBackground{false};
+  // signaled by every background submit, the graphics submit waits for it
+  VkSemaphore _computeTimeline;
+  uint64_t _computeTimelineValue{0};
   //< queues
 
   //> swap_init
@@ -116,17 +243,65 @@ struct VulkanEngine::impl {
   std::vector<VkImageView> _swapchainImageViews;
   std::vector<VkSemaphore> _swapchainSemaphores;
   VkExtent2D _swapchainExtent;
+  uint32_t _swapchainMinImageCount;
   //< swap_init
 
+  // the present mode asked for and the one the swapchain got, which is FIFO
+  // when the surface lacks the other
+  VkPresentModeKHR _requestedPresentMode{VK_PRESENT_MODE_FIFO_KHR};
+  VkPresentModeKHR _presentMode{VK_PRESENT_MODE_FIFO_KHR};
+
+  // the low latency limiter waits for the previous frame before input is
+  // sampled: until it is on screen with present wait, else until the gpu
+  // finished it
+  bool _lowLatency{false};
+  bool _presentWaitAvailable{false};
+  PFN_vkWaitForPresentKHR _vkWaitForPresentKHR{};
+  uint64_t _presentId{0};
+  struct PendingPresent {
+    uint64_t presentId;
+    uint64_t timelineValue;
+    std::chrono::steady_clock::time_point inputTime;
+  };
+  std::deque<PendingPresent> _pendingPresents;
+  std::chrono::steady_clock::time_point _inputTime;
+  double _limiterWaitMilliseconds{0};
+
+  // smoothed over the frames presented with each mode
+  struct PacingStats {
+    double cpuWaitMilliseconds{0};
+    // an upper bound, completion is only noticed when the next frame polls
+    // for it. exact for the frame the limiter blocked on
+    double latencyMilliseconds{0};
+  };
+  std::unordered_map<VkPresentModeKHR, PacingStats> _pacingStats;
+
+  // frames the next cpu trace captures
+  int _cpuTraceFrames{120};
+
+  // reads the draw image of captured frames back and writes them to disk
+  FrameCapture _frameCapture;
+  // settings of the next capture started from the ui
+  int _captureFrames{60};
+  bool _captureRaw{false};
+
+  // the draw image of the current frame. the background of the next frame is
+  // written while this one is still read, so with async compute every frame
+  // in flight has its own
   AllocatedImage _drawImage;
+  std::vector<AllocatedImage> _drawImages;
   AllocatedImage _depthImage;
   VkExtent2D _drawExtent;
 
   DescriptorAllocator globalDescriptorAllocator;
 
   VkDescriptorSet _drawImageDescriptors;
+  std::vector<VkDescriptorSet> _drawImageSets;
   VkDescriptorSetLayout _drawImageDescriptorLayout;
 
+  VkPipelineCache _pipelineCache;
+  bool _pipelineCacheWarm{false};
+
   VkPipeline _gradientPipeline;
   VkPipelineLayout _gradientPipelineLayout;
 
@@ -145,19 +320,86 @@ struct VulkanEngine::impl {
   VkPipelineLayout _meshPipelineLayout;
   VkPipeline _meshPipeline;
 
+  GeometryPool _geometryPool;
+  UploadManager _uploadManager;
+
   GPUMeshBuffers rectangle;
   std::vector<std::shared_ptr<MeshAsset>> testMeshes;
 
+  // gpu driven scene: the culling pass reads the objects and fills one
+  // indirect command stream per draw bucket, plus their counts
+  std::vector<GPUObjectData> _sceneObjects;
+  AllocatedBuffer _objectBuffer;
+  VkDeviceAddress _objectBufferAddress;
+  AllocatedBuffer _drawCommandBuffer;
+  AllocatedBuffer _drawCountBuffer;
+  glm::mat4 _viewProj;
+  glm::mat4 _view{glm::translate(glm::vec3{0, 0, -5})};
+  bool _defaultScene{true};
+  bool _validation{true};
+  bool _frustumCulling{true};
+  bool _occlusionCulling{true};
+  // 1 per object the last late culling pass found visible
+  AllocatedBuffer _visibilityBuffer;
+
+  // min reduced copy of the depth buffer, the largest power of two that fits
+  // in the draw image
+  AllocatedImage _depthPyramid;
+  VkExtent2D _depthPyramidExtent;
+  uint32_t _depthPyramidLevels;
+  std::vector<VkImageView> _depthPyramidMips;
+  VkSampler _depthReductionSampler;
+  VkDescriptorSetLayout _depthReduceDescriptorLayout;
+  // level i reads level i - 1, or the depth buffer for level 0
+  std::vector<VkDescriptorSet> _depthReduceDescriptors;
+  VkPipelineLayout _depthReducePipelineLayout;
+  VkPipeline _depthReducePipeline;
+
+  // the frustum test runs either in the culling compute pass or on the cpu,
+  // which then writes the draw commands of the frame itself
+  enum class CullingMode : int { Gpu, Cpu };
+  CullingMode _cullingMode{CullingMode::Gpu};
+  CullingBounds _cullingBounds;
+  std::vector<uint32_t> _visibleObjects;
+  CullingStats _cullingStats{};
+
+  // rebuilt every frame, keeps the state of the images and buffers between
+  // frames so the first barriers know what the last frame did
+  RenderGraph _renderGraph;
+  GpuProfiler _gpuProfiler;
+
+  // with cpu culling the visible objects can also be drawn one by one, the
+  // draws being recorded by several threads into secondary command buffers
+  bool _recordDirectDraws{false};
+  int _recordThreads{1};
+  int _maxRecordThreads{1};
+  double _recordMilliseconds{0};
+
+  VkDescriptorSetLayout _cullDescriptorLayout;
+  VkDescriptorSet _cullDescriptors;
+  VkPipelineLayout _cullPipelineLayout;
+  VkPipeline _cullPipeline;
+  VkPipelineLayout _indirectPipelineLayout;
+  VkPipeline _indirectPipeline;
+
   DeletionQueue _mainDeletionQueue;
   VmaAllocator _allocator;
 
   impl(VulkanEngine *engine) : _parent(engine) {}
   ~impl() noexcept;
   void run();
+  void run_headless();
+  void build_ui();
   void draw();
+  void wait_for_frame(const FrameData &frame);
+  void pace_frame();
+  bool present_done(const PendingPresent &present, uint64_t timeout);
+  void set_present_mode(VkPresentModeKHR mode);
 
   void init_glfw();
   void init_vulkan();
+  void init_geometry_pool();
+  void init_upload_manager();
 
   void init_swapchain();
 
@@ -166,46 +408,105 @@ struct VulkanEngine::impl {
   void init_sync_structures();
 
   void init_descriptors();
+  void init_depth_pyramid();
+  void create_transient_views();
+  void destroy_transient_views();
 
   void init_pipelines();
-  void init_background_pipelines();
-  void init_triangle_pipeline();
-  void init_mesh_pipeline();
+  void init_background_pipelines(const ShaderModules &shaders,
+                                 PipelineBuilds &builds);
+  void init_triangle_pipeline(const ShaderModules &shaders,
+                              PipelineBuilds &builds);
+  void init_mesh_pipeline(const ShaderModules &shaders,
+                          PipelineBuilds &builds);
+  void init_scene_pipelines(const ShaderModules &shaders,
+                            PipelineBuilds &builds);
 
   void init_default_data();
+  void init_scene();
+  void add_object(const MeshAsset &mesh, const glm::mat4 &transform);
+  // creates the object and draw buffers once every object is added
+  void upload_scene();
+  void set_scene(std::span<const SceneInstance> instances);
 
   void init_imgui();
 
   void immediate_submit(std::function<void(VkCommandBuffer cmd)> &&function);
   GPUMeshBuffers uploadMesh(std::span<uint32_t> indices,
                             std::span<Vertex> vertices);
+  std::vector<GPUMeshBuffers>
+  uploadMeshes(std::span<const MeshUploadInfo> meshes);
 
   void create_swapchain(uint32_t width, uint32_t height);
   void destroy_swapchain();
   AllocatedBuffer create_buffer(size_t allocSize, VkBufferUsageFlags usage,
-                                VmaMemoryUsage memoryUsage);
+                                VmaMemoryUsage memoryUsage,
+                                std::span<const uint32_t> queueFamilies = {});
   void destroy_buffer(const AllocatedBuffer &buffer);
 
+  void update_camera();
+  void build_render_graph(uint32_t swapchainImageIndex);
   void draw_background(VkCommandBuffer cmd);
+  void submit_background();
+  void cull_scene(VkCommandBuffer cmd, bool latePass);
+  void copy_cull_stats(VkCommandBuffer cmd);
+  void cull_scene_cpu();
+  void build_depth_pyramid(VkCommandBuffer cmd);
+  void set_draw_viewport(VkCommandBuffer cmd);
   void draw_geometry(VkCommandBuffer cmd);
+  void draw_geometry_late(VkCommandBuffer cmd);
+  void draw_geometry_secondary(VkCommandBuffer cmd);
+  void begin_secondary(VkCommandBuffer secondary);
+  void record_direct_draws(VkCommandBuffer secondary,
+                           std::span<const uint32_t> objects);
+  void draw_scene(VkCommandBuffer cmd);
   void draw_imgui(VkCommandBuffer cmd, VkImageView targetImageView);
 };
 
-void VulkanEngine::init() {
+void VulkanEngine::init(const EngineOptions &options) {
   self.reset(new impl{this});
-
-  self->init_glfw();
+  self->_frames.resize(
+      std::clamp(options.framesInFlight, 1u, MAX_FRAMES_IN_FLIGHT));
+  self->_requestedPresentMode = options.presentMode;
+  self->_lowLatency = options.lowLatency;
+  self->_headless = options.headless;
+  self->_headlessFrames = options.headlessFrames;
+  self->_defaultScene = options.defaultScene;
+  self->_validation = options.validation;
+  cputrace::set_thread_name("main");
+
+  // headless runs have no window, surface, swapchain or ui
+  if (!self->_headless) {
+    self->init_glfw();
+  }
   self->init_vulkan();
+  self->init_geometry_pool();
+  self->init_upload_manager();
   self->init_swapchain();
   self->init_commands();
   self->init_sync_structures();
   self->init_descriptors();
+  self->init_depth_pyramid();
   self->init_pipelines();
-  self->init_imgui();
+  if (!self->_headless) {
+    self->init_imgui();
+  }
   self->init_default_data();
+  if (self->_defaultScene) {
+    self->init_scene();
+  }
 
   // everything went fine
   self->_isInitialized = true;
+
+  if (options.cpuTraceFrames > 0) {
+    cputrace::begin_capture(options.cpuTraceFrames, CPU_TRACE_PATH);
+  }
+  if (options.captureFrames > 0) {
+    self->_frameCapture.begin(options.captureFrames, options.captureDirectory,
+                              options.captureRaw ? FrameCapture::Format::Raw
+                                                 : FrameCapture::Format::Png);
+  }
 }
 //< init_fn
 
@@ -214,6 +515,11 @@ GPUMeshBuffers VulkanEngine::uploadMesh(std::span<uint32_t> indices,
   return self->uploadMesh(indices, vertices);
 }
 
+std::vector<GPUMeshBuffers>
+VulkanEngine::uploadMeshes(std::span<const MeshUploadInfo> meshes) {
+  return self->uploadMeshes(meshes);
+}
+
 void VulkanEngine::impl::init_glfw() {
   glfwInit();
 
@@ -251,31 +557,36 @@ VulkanEngine::impl::~impl() noexcept {
     vkDeviceWaitIdle(_device);
 
     for (auto &mesh : testMeshes) {
-      destroy_buffer(mesh->meshBuffers.indexBuffer);
-      destroy_buffer(mesh->meshBuffers.vertexBuffer);
+      _geometryPool.free(mesh->meshBuffers);
     }
 
-    for (int i = 0; i < FRAME_OVERLAP; i++) {
+    for (FrameData &frame : _frames) {
 
-      vkDestroyCommandPool(_device, _frames[i]._commandPool, nullptr);
+      vkDestroyCommandPool(_device, frame._commandPool, nullptr);
+      vkDestroyCommandPool(_device, frame._computePool, nullptr);
+      for (VkCommandPool pool : frame._recordPools) {
+        vkDestroyCommandPool(_device, pool, nullptr);
+      }
 
       // destroy sync objects
-      vkDestroyFence(_device, _frames[i]._renderFence, nullptr);
-      vkDestroySemaphore(_device, _frames[i]._swapchainSemaphore, nullptr);
-      _frames[i]._deletionQueue.flush();
+      vkDestroySemaphore(_device, frame._swapchainSemaphore, nullptr);
+      frame._deletionQueue.flush();
     }
 
     _mainDeletionQueue.flush();
 
-    destroy_swapchain();
-
-    vkDestroySurfaceKHR(_instance, _surface, nullptr);
+    if (!_headless) {
+      destroy_swapchain();
+      vkDestroySurfaceKHR(_instance, _surface, nullptr);
+    }
 
     vkDestroyDevice(_device, nullptr);
     vkb::destroy_debug_utils_messenger(_instance, _debug_messenger);
     vkDestroyInstance(_instance, nullptr);
 
-    glfwDestroyWindow(_window);
+    if (!_headless) {
+      glfwDestroyWindow(_window);
+    }
   }
 }
 
@@ -284,24 +595,69 @@ void VulkanEngine::cleanup() { self.reset(); }
 void VulkanEngine::draw() { self->draw(); }
 
 void VulkanEngine::impl::draw() {
-  glfwSetWindowTitle(_window, fmt::format("frame: {}", _frameNumber).data());
+  CPU_ZONE("draw");
+  if (!_headless) {
+    glfwSetWindowTitle(_window, fmt::format("frame: {}", _frameNumber).data());
+  }
+
+  auto frameStart = std::chrono::steady_clock::now();
+  _frameMilliseconds = std::chrono::duration<double, std::milli>(
+                           frameStart - _lastFrameStart)
+                           .count();
+  _lastFrameStart = frameStart;
 
   //> draw_1
-  // wait until the gpu has finished rendering the last frame. Timeout of 1
-  // second
-  VK_CHECK(vkWaitForFences(_device, 1, &get_current_frame()._renderFence, true,
-                           1000000000));
+  // wait until the gpu has finished the last time this frame was rendered
+  wait_for_frame(get_current_frame());
+  _frameWaitMilliseconds = std::chrono::duration<double, std::milli>(
+                               std::chrono::steady_clock::now() - frameStart)
+                               .count();
   get_current_frame()._deletionQueue.flush();
-  VK_CHECK(vkResetFences(_device, 1, &get_current_frame()._renderFence));
+  _gpuProfiler.begin_frame(_frameNumber % _frames.size());
+  _frameCapture.begin_frame(_frameNumber % _frames.size());
+
+  // the gpu culling counts of the last time this frame was rendered
+  if (FrameData &frame = get_current_frame(); frame._cullStatsPasses > 0) {
+    vmaInvalidateAllocation(_allocator, frame._cullStatsBuffer.allocation, 0,
+                            VK_WHOLE_SIZE);
+    auto *counts = (const uint32_t *)frame._cullStatsBuffer.info.pMappedData;
+    uint32_t visible = 0;
+    for (uint32_t i = 0; i < frame._cullStatsPasses * DRAW_BUCKET_COUNT; ++i) {
+      visible += counts[i];
+    }
+    _cullingStats = {.tested = (uint32_t)_sceneObjects.size(),
+                     .visible = visible};
+    frame._cullStatsPasses = 0;
+  }
   //< draw_1
 
+  _drawImage = _drawImages[_frameNumber % _drawImages.size()];
+  _drawImageDescriptors = _drawImageSets[_frameNumber % _drawImages.size()];
+  _drawExtent.width = _drawImage.imageExtent.width;
+  _drawExtent.height = _drawImage.imageExtent.height;
+
+  // the background needs nothing from the frame, so it can start on the
+  // compute queue before the swapchain image is even acquired
+  bool asyncBackground = _asyncComputeAvailable && _asyncBackground;
+  if (asyncBackground) {
+    submit_background();
+  }
+
   //> draw_2
   // request image from the swapchain
-  uint32_t swapchainImageIndex;
-
-  VK_CHECK(vkAcquireNextImageKHR(_device, _swapchain, 1000000000,
-                                 get_current_frame()._swapchainSemaphore,
-                                 nullptr, &swapchainImageIndex));
+  uint32_t swapchainImageIndex = 0;
+
+  auto acquireStart = std::chrono::steady_clock::now();
+  if (!_headless) {
+    CPU_ZONE("acquire");
+    VK_CHECK(vkAcquireNextImageKHR(_device, _swapchain, 1000000000,
+                                   get_current_frame()._swapchainSemaphore,
+                                   nullptr, &swapchainImageIndex));
+  }
+  // blocking on the swapchain counts as waiting for the gpu as well
+  _frameWaitMilliseconds += std::chrono::duration<double, std::milli>(
+                                std::chrono::steady_clock::now() - acquireStart)
+                                .count();
   //< draw_2
 
   //> draw_3
@@ -317,51 +673,38 @@ void VulkanEngine::impl::draw() {
   VkCommandBufferBeginInfo cmdBeginInfo = vkinit::command_buffer_begin_info(
       VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT);
 
-  _drawExtent.width = _drawImage.imageExtent.width;
-  _drawExtent.height = _drawImage.imageExtent.height;
-
   VK_CHECK(vkBeginCommandBuffer(cmd, &cmdBeginInfo));
+  auto frameScope = _gpuProfiler.begin_scope(cmd, "frame");
 
-  // transition our main draw image into general layout so we can write into it
-  // we will overwrite it all so we dont care about what was the older layout
-  vkutil::transition_image(cmd, _drawImage.image, VK_IMAGE_LAYOUT_UNDEFINED,
-                           VK_IMAGE_LAYOUT_GENERAL);
+  update_camera();
+  // the cpu path fills this frame's indirect buffer before the gpu starts
+  if (_cullingMode == CullingMode::Cpu) {
+    cull_scene_cpu();
+  }
 
-  draw_background(cmd);
+  // take the draw image back from the compute queue, the graph starts from
+  // the state this leaves it in
+  if (asyncBackground) {
+    vkutil::acquire_image(cmd, _drawImage.image, _computeQueueFamily,
+                          _graphicsQueueFamily, VK_IMAGE_LAYOUT_GENERAL,
+                          VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+                          VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT,
+                          VK_ACCESS_2_COLOR_ATTACHMENT_READ_BIT |
+                              VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT);
+  }
 
-  vkutil::transition_image(cmd, _drawImage.image, VK_IMAGE_LAYOUT_GENERAL,
-                           VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
-  vkutil::transition_image(cmd, _depthImage.image, VK_IMAGE_LAYOUT_UNDEFINED,
-                           VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL);
-
-  draw_geometry(cmd);
-
-  // transition the draw image and the swapchain image into their correct
-  // transfer layouts
-  vkutil::transition_image(cmd, _drawImage.image,
-                           VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
-                           VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL);
-  vkutil::transition_image(cmd, _swapchainImages[swapchainImageIndex],
-                           VK_IMAGE_LAYOUT_UNDEFINED,
-                           VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
-  // execute a copy from the draw image into the swapchain
-  vkutil::copy_image_to_image(cmd, _drawImage.image,
-                              _swapchainImages[swapchainImageIndex],
-                              _drawExtent, _swapchainExtent);
-
-  // set swapchain image layout to Attachment Optimal so we can draw it
-  vkutil::transition_image(cmd, _swapchainImages[swapchainImageIndex],
-                           VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-                           VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
-
-  // draw imgui into the swapchain image
-  draw_imgui(cmd, _swapchainImageViews[swapchainImageIndex]);
-
-  // set swapchain image layout to Present so we can draw it
-  vkutil::transition_image(cmd, _swapchainImages[swapchainImageIndex],
-                           VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
-                           VK_IMAGE_LAYOUT_PRESENT_SRC_KHR);
+  // the passes record in order, the graph puts the layout transitions and
+  // barriers between them
+  {
+    CPU_ZONE("build render graph");
+    build_render_graph(swapchainImageIndex);
+  }
+  {
+    CPU_ZONE("record");
+    _renderGraph.execute(cmd);
+  }
 
+  _gpuProfiler.end_scope(cmd, frameScope);
   // finalize the command buffer (we can no longer add commands, but it can now
   // be executed)
   VK_CHECK(vkEndCommandBuffer(cmd));
@@ -374,22 +717,56 @@ void VulkanEngine::impl::draw() {
 
   VkCommandBufferSubmitInfo cmdinfo = vkinit::command_buffer_submit_info(cmd);
 
-  VkSemaphoreSubmitInfo waitInfo[] = {vkinit::semaphore_submit_info(
-      VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT_KHR,
-      get_current_frame()._swapchainSemaphore)};
-  VkSemaphoreSubmitInfo signalInfo[] = {
-      vkinit::semaphore_submit_info(VK_PIPELINE_STAGE_2_ALL_GRAPHICS_BIT,
-                                    _swapchainSemaphores[swapchainImageIndex]),
-  };
+  // also wait for every upload flushed so far before the culling pass reads
+  // the objects and vertices are pulled
+  VkSemaphoreSubmitInfo uploadWait = vkinit::semaphore_submit_info(
+      VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT |
+          VK_PIPELINE_STAGE_2_INDEX_INPUT_BIT |
+          VK_PIPELINE_STAGE_2_VERTEX_SHADER_BIT,
+      _uploadManager.timeline);
+  uploadWait.value = _uploadManager.submittedValue;
+
+  std::vector<VkSemaphoreSubmitInfo> waitInfo = {uploadWait};
+  if (!_headless) {
+    waitInfo.push_back(vkinit::semaphore_submit_info(
+        VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT_KHR,
+        get_current_frame()._swapchainSemaphore));
+  }
+  // the acquire of the draw image waits at color output as well
+  if (asyncBackground) {
+    VkSemaphoreSubmitInfo computeWait = vkinit::semaphore_submit_info(
+        VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT, _computeTimeline);
+    computeWait.value = _computeTimelineValue;
+    waitInfo.push_back(computeWait);
+  }
+  // the timeline value tells the cpu when the frame can be reused
+  get_current_frame()._timelineValue = ++_graphicsTimelineValue;
+  VkSemaphoreSubmitInfo timelineSignal = vkinit::semaphore_submit_info(
+      VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT, _graphicsTimeline);
+  timelineSignal.value = _graphicsTimelineValue;
+
+  std::vector<VkSemaphoreSubmitInfo> signalInfo = {timelineSignal};
+  if (!_headless) {
+    signalInfo.push_back(vkinit::semaphore_submit_info(
+        VK_PIPELINE_STAGE_2_ALL_GRAPHICS_BIT,
+        _swapchainSemaphores[swapchainImageIndex]));
+  }
 
   VkSubmitInfo2 submit = vkinit::submit_info(&cmdinfo, signalInfo, waitInfo);
 
   // submit command buffer to the queue and execute it.
-  //  _renderFence will now block until the graphic commands finish execution
-  VK_CHECK(vkQueueSubmit2(_graphicsQueue, 1, &submit,
-                          get_current_frame()._renderFence));
+  {
+    CPU_ZONE("submit");
+    VK_CHECK(vkQueueSubmit2(_graphicsQueue, 1, &submit, VK_NULL_HANDLE));
+  }
   //< draw_5
-  //
+
+  // nothing to present without a swapchain
+  if (_headless) {
+    _frameNumber++;
+    return;
+  }
+
   //> draw_6
   // prepare present
   // this will put the image we just rendered to into the visible window.
@@ -408,7 +785,29 @@ void VulkanEngine::impl::draw() {
 
   presentInfo.pImageIndices = &swapchainImageIndex;
 
-  VK_CHECK(vkQueuePresentKHR(_graphicsQueue, &presentInfo));
+  // tag the present so the limiter can wait for it to reach the screen
+  uint64_t presentId = ++_presentId;
+  VkPresentIdKHR presentIdInfo{.sType = VK_STRUCTURE_TYPE_PRESENT_ID_KHR};
+  presentIdInfo.swapchainCount = 1;
+  presentIdInfo.pPresentIds = &presentId;
+  if (_presentWaitAvailable) {
+    presentInfo.pNext = &presentIdInfo;
+  }
+
+  {
+    CPU_ZONE("present");
+    VK_CHECK(vkQueuePresentKHR(_graphicsQueue, &presentInfo));
+  }
+
+  _pendingPresents.push_back({.presentId = presentId,
+                              .timelineValue = _graphicsTimelineValue,
+                              .inputTime = _inputTime});
+
+  PacingStats &stats = _pacingStats[_presentMode];
+  stats.cpuWaitMilliseconds +=
+      (_limiterWaitMilliseconds + _frameWaitMilliseconds -
+       stats.cpuWaitMilliseconds) *
+      0.05;
 
   // increase the number of frames drawn
   _frameNumber++;
@@ -416,16 +815,145 @@ void VulkanEngine::impl::draw() {
   //< draw_6
 }
 
+void VulkanEngine::impl::wait_for_frame(const FrameData &frame) {
+  CPU_ZONE("wait for frame");
+  VkSemaphoreWaitInfo waitInfo{.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO};
+  waitInfo.semaphoreCount = 1;
+  waitInfo.pSemaphores = &_graphicsTimeline;
+  waitInfo.pValues = &frame._timelineValue;
+
+  // a slow frame is not an error, only a lost device is
+  while (true) {
+    VkResult result = vkWaitSemaphores(_device, &waitInfo, 1000000000);
+    if (result != VK_TIMEOUT) {
+      VK_CHECK(result);
+      return;
+    }
+    fmt::println("Still waiting for frame {} after a second",
+                 frame._timelineValue);
+  }
+}
+
+void VulkanEngine::impl::pace_frame() {
+  CPU_ZONE("pace frame");
+  auto start = std::chrono::steady_clock::now();
+  if (_lowLatency && !_pendingPresents.empty()) {
+    // a present that never completes only costs this frame the timeout
+    present_done(_pendingPresents.back(), 1000000000);
+  }
+  _inputTime = std::chrono::steady_clock::now();
+  _limiterWaitMilliseconds =
+      std::chrono::duration<double, std::milli>(_inputTime - start).count();
+
+  // presents complete in order, so stop at the first one still pending.
+  // they may have completed up to a frame before this poll, which the
+  // latency includes
+  PacingStats &stats = _pacingStats[_presentMode];
+  while (!_pendingPresents.empty() &&
+         present_done(_pendingPresents.front(), 0)) {
+    double latency = std::chrono::duration<double, std::milli>(
+                         _inputTime - _pendingPresents.front().inputTime)
+                         .count();
+    stats.latencyMilliseconds +=
+        (latency - stats.latencyMilliseconds) * 0.05;
+    _pendingPresents.pop_front();
+  }
+}
+
+bool VulkanEngine::impl::present_done(const PendingPresent &present,
+                                      uint64_t timeout) {
+  if (_presentWaitAvailable) {
+    VkResult result = _vkWaitForPresentKHR(_device, _swapchain,
+                                           present.presentId, timeout);
+    if (result == VK_TIMEOUT) {
+      return false;
+    }
+    // suboptimal still means it was presented
+    if (result < 0) {
+      VK_CHECK(result);
+    }
+    return true;
+  }
+
+  VkSemaphoreWaitInfo waitInfo{.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO};
+  waitInfo.semaphoreCount = 1;
+  waitInfo.pSemaphores = &_graphicsTimeline;
+  waitInfo.pValues = &present.timelineValue;
+  VkResult result = vkWaitSemaphores(_device, &waitInfo, timeout);
+  if (result == VK_TIMEOUT) {
+    return false;
+  }
+  VK_CHECK(result);
+  return true;
+}
+
+void VulkanEngine::impl::set_present_mode(VkPresentModeKHR mode) {
+  _requestedPresentMode = mode;
+
+  vkDeviceWaitIdle(_device);
+  destroy_swapchain();
+  create_swapchain(_windowExtent.width, _windowExtent.height);
+  ImGui_ImplVulkan_SetMinImageCount(_swapchainMinImageCount);
+
+  // the ids belong to the old swapchain
+  _pendingPresents.clear();
+}
+
 void VulkanEngine::run() { self->run(); }
 
+void VulkanEngine::request_stop() { self->_stopRequested = true; }
+
+void VulkanEngine::set_scene(std::span<const SceneInstance> instances) {
+  self->set_scene(instances);
+}
+
+void VulkanEngine::set_camera(const glm::mat4 &view) { self->_view = view; }
+
+std::vector<GpuProfiler::ScopeStats> VulkanEngine::gpu_pass_stats() const {
+  return self->_gpuProfiler.stats();
+}
+
+std::vector<MemoryHeapUsage> VulkanEngine::memory_usage() const {
+  const VkPhysicalDeviceMemoryProperties *properties;
+  vmaGetMemoryProperties(self->_allocator, &properties);
+
+  std::vector<VmaBudget> budgets(properties->memoryHeapCount);
+  vmaGetHeapBudgets(self->_allocator, budgets.data());
+
+  std::vector<MemoryHeapUsage> heaps;
+  for (uint32_t i = 0; i < properties->memoryHeapCount; ++i) {
+    heaps.push_back(
+        {.deviceLocal = (properties->memoryHeaps[i].flags &
+                         VK_MEMORY_HEAP_DEVICE_LOCAL_BIT) != 0,
+         .allocationBytes = budgets[i].statistics.allocationBytes,
+         .usageBytes = budgets[i].usage,
+         .budgetBytes = budgets[i].budget});
+  }
+  return heaps;
+}
+
 void VulkanEngine::impl::run() {
+  if (_headless) {
+    run_headless();
+    return;
+  }
+
   // SDL_Event e;
   bool bQuit = false;
 
   // main loop
-  while (!bQuit && !glfwWindowShouldClose(_window)) {
+  while (!bQuit && !_stopRequested && !glfwWindowShouldClose(_window)) {
+    cputrace::end_frame();
+    CPU_ZONE("frame");
+
+    // the limiter waits here, so the input below is as fresh as possible
+    pace_frame();
+
     // Handle events on queue
-    glfwPollEvents();
+    {
+      CPU_ZONE("poll events");
+      glfwPollEvents();
+    }
 
     // do not draw if we are minimized
     if (stop_rendering) {
@@ -434,29 +962,184 @@ void VulkanEngine::impl::run() {
       continue;
     }
 
-    ImGui_ImplVulkan_NewFrame();
-    ImGui_ImplGlfw_NewFrame();
-    ImGui::NewFrame();
+    {
+      CPU_ZONE("imgui new frame");
+      ImGui_ImplVulkan_NewFrame();
+      ImGui_ImplGlfw_NewFrame();
+      ImGui::NewFrame();
+    }
+
+    {
+      CPU_ZONE("build ui");
+      build_ui();
+    }
 
-    if (ImGui::Begin("background")) {
+    {
+      CPU_ZONE("imgui render");
+      ImGui::Render();
+    }
+    draw();
+  }
+}
 
-      ComputeEffect &selected = backgroundEffects[currentBackgroundEffect];
+void VulkanEngine::impl::run_headless() {
+  if (_headlessFrames > 0) {
+    fmt::println("Rendering {} frames headless", _headlessFrames);
+  } else {
+    fmt::println("Rendering headless until stopped");
+  }
 
-      ImGui::Text("Selected effect: %s", selected.name);
+  auto start = std::chrono::steady_clock::now();
+  uint32_t frames = 0;
+  while (!_stopRequested &&
+         (_headlessFrames == 0 || frames < _headlessFrames)) {
+    cputrace::end_frame();
+    CPU_ZONE("frame");
+    draw();
+    ++frames;
+  }
+  // the last frames in flight count once the gpu is done with them
+  vkDeviceWaitIdle(_device);
+  cputrace::end_frame();
+
+  double seconds = std::chrono::duration<double>(
+                       std::chrono::steady_clock::now() - start)
+                       .count();
+  fmt::println("{} frames in {:.3f} s: {:.1f} frames/s, {:.3f} ms/frame",
+               frames, seconds, frames / seconds,
+               frames > 0 ? seconds * 1000.0 / frames : 0.0);
+}
 
-      ImGui::SliderInt("Effect Index", &currentBackgroundEffect, 0,
-                       backgroundEffects.size() - 1);
+void VulkanEngine::impl::build_ui() {
+  if (ImGui::Begin("background")) {
 
-      ImGui::ColorEdit4("data1", (float *)&selected.data.data1);
-      ImGui::ColorEdit4("data2", (float *)&selected.data.data2);
-      ImGui::ColorEdit4("data3", (float *)&selected.data.data3);
-      ImGui::ColorEdit4("data4", (float *)&selected.data.data4);
-    }
-    ImGui::End();
+    ComputeEffect &selected = backgroundEffects[currentBackgroundEffect];
 
-    ImGui::Render();
-    draw();
+    ImGui::Text("Selected effect: %s", selected.name);
+
+    ImGui::SliderInt("Effect Index", &currentBackgroundEffect, 0,
+                     backgroundEffects.size() - 1);
+
+    ImGui::ColorEdit4("data1", (float *)&selected.data.data1);
+    ImGui::ColorEdit4("data2", (float *)&selected.data.data2);
+    ImGui::ColorEdit4("data3", (float *)&selected.data.data3);
+    ImGui::ColorEdit4("data4", (float *)&selected.data.data4);
+
+    if (_asyncComputeAvailable) {
+      ImGui::Checkbox("Run on the compute queue", &_asyncBackground);
+    }
+  }
+  ImGui::End();
+
+  if (ImGui::Begin("scene")) {
+    ImGui::Text("Objects: %zu", _sceneObjects.size());
+    ImGui::Text("Frames in flight: %zu, frame %.2f ms, %.2f ms waiting "
+                "for the gpu",
+                _frames.size(), _frameMilliseconds, _frameWaitMilliseconds);
+    ImGui::Checkbox("Frustum culling", &_frustumCulling);
+    ImGui::Checkbox("Occlusion culling (GPU only)", &_occlusionCulling);
+    ImGui::Combo("Culling on", (int *)&_cullingMode, "GPU\0CPU\0");
+
+    ImGui::Text("Visible: %u, culled: %u", _cullingStats.visible,
+                _cullingStats.tested - _cullingStats.visible);
+    ImGui::Text("Render graph: %u barriers in %u batches, %u passes culled",
+                _renderGraph.imageBarriers + _renderGraph.bufferBarriers,
+                _renderGraph.barrierBatches, _renderGraph.culledPasses);
+    ImGui::Text("Transient memory: %.1f MiB, %.1f MiB without aliasing",
+                _renderGraph.transientMemory.aliased / (1024.0 * 1024.0),
+                _renderGraph.transientMemory.dedicated / (1024.0 * 1024.0));
+    if (_cullingMode == CullingMode::Cpu) {
+      ImGui::Text("CPU culling: %.3f ms", _cullingStats.milliseconds);
+
+      ImGui::Checkbox("Record per-object draws", &_recordDirectDraws);
+      if (_recordDirectDraws) {
+        ImGui::SliderInt("Recording jobs", &_recordThreads, 1,
+                         _maxRecordThreads);
+        ImGui::Text("Recording: %.3f ms", _recordMilliseconds);
+      }
+    }
+  }
+  ImGui::End();
+
+  if (ImGui::Begin("gpu profiler")) {
+    if (!_gpuProfiler.enabled()) {
+      ImGui::Text("Timestamps are not supported");
+    } else if (ImGui::BeginTable("scopes", 5)) {
+      ImGui::TableSetupColumn("scope");
+      ImGui::TableSetupColumn("avg ms");
+      ImGui::TableSetupColumn("p50");
+      ImGui::TableSetupColumn("p95");
+      ImGui::TableSetupColumn("p99");
+      ImGui::TableHeadersRow();
+      for (const GpuProfiler::ScopeStats &scope : _gpuProfiler.stats()) {
+        ImGui::TableNextRow();
+        ImGui::TableNextColumn();
+        ImGui::TextUnformatted(scope.name.c_str());
+        for (double value :
+             {scope.average, scope.p50, scope.p95, scope.p99}) {
+          ImGui::TableNextColumn();
+          ImGui::Text("%.3f", value);
+        }
+      }
+      ImGui::EndTable();
+    }
+  }
+  ImGui::End();
+
+  if (ImGui::Begin("cpu profiler")) {
+    ImGui::SliderInt("Frames", &_cpuTraceFrames, 1, 1000);
+    if (uint32_t remaining = cputrace::remaining_frames(); remaining > 0) {
+      ImGui::Text("Capturing, %u frames left", remaining);
+    } else if (ImGui::Button("Capture trace")) {
+      cputrace::begin_capture(_cpuTraceFrames, CPU_TRACE_PATH);
+    }
+    ImGui::Text("Written to %s", CPU_TRACE_PATH);
   }
+  ImGui::End();
+
+  if (ImGui::Begin("frame capture")) {
+    ImGui::SliderInt("Frames", &_captureFrames, 1, 1000);
+    ImGui::Checkbox("Raw pixels instead of png", &_captureRaw);
+    if (uint32_t remaining = _frameCapture.remaining(); remaining > 0) {
+      ImGui::Text("Capturing, %u frames left", remaining);
+    } else if (ImGui::Button("Capture frames")) {
+      _frameCapture.begin(_captureFrames, CAPTURE_DIRECTORY,
+                          _captureRaw ? FrameCapture::Format::Raw
+                                      : FrameCapture::Format::Png);
+    }
+    ImGui::Text("Frames waiting for the writers: %zu", _frameCapture.queued());
+    ImGui::Text("Written to %s", CAPTURE_DIRECTORY);
+  }
+  ImGui::End();
+
+  if (ImGui::Begin("presentation")) {
+    constexpr VkPresentModeKHR modes[] = {
+        VK_PRESENT_MODE_FIFO_KHR, VK_PRESENT_MODE_FIFO_RELAXED_KHR,
+        VK_PRESENT_MODE_MAILBOX_KHR, VK_PRESENT_MODE_IMMEDIATE_KHR};
+    int selected = (int)(std::ranges::find(modes, _requestedPresentMode) -
+                         std::begin(modes));
+    if (ImGui::Combo("Present mode", &selected,
+                     "FIFO\0FIFO relaxed\0Mailbox\0Immediate\0") &&
+        modes[selected] != _requestedPresentMode) {
+      set_present_mode(modes[selected]);
+    }
+    ImGui::Text("Presenting with %s",
+                string_VkPresentModeKHR(_presentMode));
+
+    ImGui::Checkbox("Low latency limiter", &_lowLatency);
+    ImGui::Text("Latency measured to %s", _presentWaitAvailable
+                                              ? "present (present wait)"
+                                              : "gpu completion");
+    ImGui::Text("Completion is polled once per frame, the latency can be up "
+                "to a frame high");
+
+    for (auto &[mode, stats] : _pacingStats) {
+      ImGui::Text("%s: cpu wait %.2f ms, input latency <= %.2f ms",
+                  string_VkPresentModeKHR(mode), stats.cpuWaitMilliseconds,
+                  stats.latencyMilliseconds);
+    }
+  }
+  ImGui::End();
 }
 
 void VulkanEngine::impl::init_vulkan() {
@@ -465,9 +1148,11 @@ void VulkanEngine::impl::init_vulkan() {
 
   // make the vulkan instance, with basic debug features
   auto inst_ret = builder.set_app_name("Example Vulkan Application")
-                      .request_validation_layers(bUseValidationLayers)
+                      .request_validation_layers(_validation)
                       .use_default_debug_messenger()
                       .require_api_version(1, 3, 0)
+                      // no surface extensions, so it runs without a display
+                      .set_headless(_headless)
                       .build();
 
   vkb::Instance vkb_inst = inst_ret.value();
@@ -479,7 +1164,9 @@ void VulkanEngine::impl::init_vulkan() {
   //< init_instance
   //
   //> init_device
-  glfwCreateWindowSurface(_instance, _window, nullptr, &_surface);
+  if (!_headless) {
+    glfwCreateWindowSurface(_instance, _window, nullptr, &_surface);
+  }
 
   // vulkan 1.3 features
   VkPhysicalDeviceVulkan13Features features{
@@ -492,17 +1179,51 @@ void VulkanEngine::impl::init_vulkan() {
       .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES};
   features12.bufferDeviceAddress = true;
   features12.descriptorIndexing = true;
+  features12.timelineSemaphore = true;
+  features12.drawIndirectCount = true;
+  // min reduction sampler for the depth pyramid
+  features12.samplerFilterMinmax = true;
+  // the gpu profiler resets its queries from the cpu
+  features12.hostQueryReset = true;
+
+  // the indirect draws pass the object index through firstInstance, and the
+  // cpu culling path issues a bucket's draws as one call with a draw count
+  // above 1. the gpu culling path counts with drawIndirectCount above
+  VkPhysicalDeviceFeatures features10{};
+  features10.drawIndirectFirstInstance = true;
+  features10.multiDrawIndirect = true;
 
   // use vkbootstrap to select a gpu.
   // We want a gpu that can write to the SDL surface and supports vulkan 1.3
   // with the correct features
+  // headless, any device will do, presenting or not. that includes software
+  // implementations like lavapipe
   vkb::PhysicalDeviceSelector selector{vkb_inst};
-  vkb::PhysicalDevice physicalDevice = selector.set_minimum_version(1, 3)
-                                           .set_required_features_13(features)
-                                           .set_required_features_12(features12)
-                                           .set_surface(_surface)
-                                           .select()
-                                           .value();
+  selector.set_minimum_version(1, 3)
+      .set_required_features_13(features)
+      .set_required_features_12(features12)
+      .set_required_features(features10);
+  if (!_headless) {
+    selector.set_surface(_surface);
+  }
+  vkb::PhysicalDevice physicalDevice = selector.select().value();
+  fmt::println("Running on {}", physicalDevice.name);
+
+  // present wait lets the low latency limiter block until a frame is on
+  // screen. optional, the limiter falls back to the graphics timeline
+  VkPhysicalDevicePresentIdFeaturesKHR presentIdFeatures{
+      .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PRESENT_ID_FEATURES_KHR};
+  presentIdFeatures.presentId = true;
+  VkPhysicalDevicePresentWaitFeaturesKHR presentWaitFeatures{
+      .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PRESENT_WAIT_FEATURES_KHR};
+  presentWaitFeatures.presentWait = true;
+  _presentWaitAvailable =
+      !_headless &&
+      physicalDevice.enable_extensions_if_present(
+          {VK_KHR_PRESENT_ID_EXTENSION_NAME,
+           VK_KHR_PRESENT_WAIT_EXTENSION_NAME}) &&
+      physicalDevice.enable_extension_features_if_present(presentIdFeatures) &&
+      physicalDevice.enable_extension_features_if_present(presentWaitFeatures);
 
   // create the final vulkan device
   vkb::DeviceBuilder deviceBuilder{physicalDevice};
@@ -512,6 +1233,13 @@ void VulkanEngine::impl::init_vulkan() {
   // Get the VkDevice handle used in the rest of a vulkan application
   _device = vkbDevice.device;
   _chosenGPU = physicalDevice.physical_device;
+
+  if (_presentWaitAvailable) {
+    _vkWaitForPresentKHR = (PFN_vkWaitForPresentKHR)vkGetDeviceProcAddr(
+        _device, "vkWaitForPresentKHR");
+  }
+  fmt::println("Present wait {}",
+               _presentWaitAvailable ? "available" : "not available");
   //< init_device
 
   //> init_queue
@@ -519,6 +1247,42 @@ void VulkanEngine::impl::init_vulkan() {
   _graphicsQueue = vkbDevice.get_queue(vkb::QueueType::graphics).value();
   _graphicsQueueFamily =
       vkbDevice.get_queue_index(vkb::QueueType::graphics).value();
+
+  // prefer a transfer only queue for uploads, then any queue family other than
+  // graphics that can transfer, then the graphics queue itself
+  if (auto queue = vkbDevice.get_dedicated_queue(vkb::QueueType::transfer)) {
+    _transferQueue = queue.value();
+    _transferQueueFamily =
+        vkbDevice.get_dedicated_queue_index(vkb::QueueType::transfer).value();
+  } else if (auto queue = vkbDevice.get_queue(vkb::QueueType::transfer)) {
+    _transferQueue = queue.value();
+    _transferQueueFamily =
+        vkbDevice.get_queue_index(vkb::QueueType::transfer).value();
+  } else {
+    _transferQueue = _graphicsQueue;
+    _transferQueueFamily = _graphicsQueueFamily;
+  }
+  fmt::println("Uploading through queue family {} (graphics is {})",
+               _transferQueueFamily, _graphicsQueueFamily);
+
+  // any compute family other than graphics, it does not have to be
+  // dedicated. without one everything stays on the graphics queue
+  if (auto queue = vkbDevice.get_queue(vkb::QueueType::compute)) {
+    _computeQueue = queue.value();
+    _computeQueueFamily =
+        vkbDevice.get_queue_index(vkb::QueueType::compute).value();
+  } else {
+    _computeQueue = _graphicsQueue;
+    _computeQueueFamily = _graphicsQueueFamily;
+  }
+  _asyncComputeAvailable = _computeQueueFamily != _graphicsQueueFamily;
+  _asyncBackground = _asyncComputeAvailable;
+  fmt::println("Background effect on queue family {}", _computeQueueFamily);
+
+  _sharedQueueFamilies = {_graphicsQueueFamily};
+  if (_transferQueueFamily != _graphicsQueueFamily) {
+    _sharedQueueFamilies.push_back(_transferQueueFamily);
+  }
   //< init_queue
 
   // initialize the memory allocator
@@ -530,10 +1294,51 @@ void VulkanEngine::impl::init_vulkan() {
   vmaCreateAllocator(&allocatorInfo, &_allocator);
 
   _mainDeletionQueue.push_function([&]() { vmaDestroyAllocator(_allocator); });
+
+  _renderGraph.init(_device, _allocator);
+  _mainDeletionQueue.push_function([this]() { _renderGraph.destroy(); });
+
+  // times the graph passes, and the background on the compute queue
+  uint32_t profiledFamilies[] = {_graphicsQueueFamily, _computeQueueFamily};
+  _gpuProfiler.init(_device, _chosenGPU, profiledFamilies,
+                    (uint32_t)_frames.size());
+  _renderGraph.profiler = &_gpuProfiler;
+  _mainDeletionQueue.push_function([this]() { _gpuProfiler.destroy(); });
+
+  // reuse the pipelines compiled by previous runs on this gpu and driver
+  _pipelineCache = vkutil::load_pipeline_cache(PIPELINE_CACHE_PATH, _device,
+                                               _chosenGPU, &_pipelineCacheWarm);
+
+  _mainDeletionQueue.push_function([this]() {
+    if (!vkutil::save_pipeline_cache(PIPELINE_CACHE_PATH, _device, _chosenGPU,
+                                     _pipelineCache)) {
+      fmt::println("Failed to save the pipeline cache to {}",
+                   PIPELINE_CACHE_PATH);
+    }
+    vkDestroyPipelineCache(_device, _pipelineCache, nullptr);
+  });
+}
+
+void VulkanEngine::impl::init_geometry_pool() {
+  _geometryPool.init(_device, _allocator, GEOMETRY_POOL_VERTEX_BYTES,
+                     GEOMETRY_POOL_INDEX_BYTES, _sharedQueueFamilies);
+
+  _mainDeletionQueue.push_function(
+      [this]() { _geometryPool.destroy(_allocator); });
+}
+
+void VulkanEngine::impl::init_upload_manager() {
+  _uploadManager.init(_device, _allocator, _transferQueue,
+                      _transferQueueFamily, UPLOAD_RING_BYTES);
+
+  _mainDeletionQueue.push_function(
+      [this]() { _uploadManager.destroy(_allocator); });
 }
 
 void VulkanEngine::impl::init_swapchain() {
-  create_swapchain(_windowExtent.width, _windowExtent.height);
+  if (!_headless) {
+    create_swapchain(_windowExtent.width, _windowExtent.height);
+  }
 
   // draw image size will match the window
   VkExtent3D drawImageExtent = {_windowExtent.width, _windowExtent.height, 1};
@@ -557,42 +1362,37 @@ void VulkanEngine::impl::init_swapchain() {
   rimg_allocinfo.requiredFlags =
       VkMemoryPropertyFlags(VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
 
-  // allocate and create the image
-  vmaCreateImage(_allocator, &rimg_info, &rimg_allocinfo, &_drawImage.image,
-                 &_drawImage.allocation, nullptr);
+  // one per frame in flight when the background runs asynchronously
+  _drawImages.resize(_asyncComputeAvailable ? _frames.size() : 1, _drawImage);
+  for (AllocatedImage &drawImage : _drawImages) {
+    // allocate and create the image
+    vmaCreateImage(_allocator, &rimg_info, &rimg_allocinfo, &drawImage.image,
+                   &drawImage.allocation, nullptr);
 
-  // build a image-view for the draw image to use for rendering
-  VkImageViewCreateInfo rview_info = vkinit::imageview_create_info(
-      _drawImage.imageFormat, _drawImage.image, VK_IMAGE_ASPECT_COLOR_BIT);
+    // build a image-view for the draw image to use for rendering
+    VkImageViewCreateInfo rview_info = vkinit::imageview_create_info(
+        drawImage.imageFormat, drawImage.image, VK_IMAGE_ASPECT_COLOR_BIT);
 
-  VK_CHECK(
-      vkCreateImageView(_device, &rview_info, nullptr, &_drawImage.imageView));
+    VK_CHECK(
+        vkCreateImageView(_device, &rview_info, nullptr, &drawImage.imageView));
+  }
+  _drawImage = _drawImages[0];
 
+  // the depth image is transient, the render graph creates it with the
+  // memory it shares with the other transients
   _depthImage.imageFormat = VK_FORMAT_D32_SFLOAT;
   _depthImage.imageExtent = drawImageExtent;
-  VkImageUsageFlags depthImageUsages{};
-  depthImageUsages |= VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT;
-
-  VkImageCreateInfo dimg_info = vkinit::image_create_info(
-      _depthImage.imageFormat, depthImageUsages, drawImageExtent);
-
-  // allocate and create the image
-  vmaCreateImage(_allocator, &dimg_info, &rimg_allocinfo, &_depthImage.image,
-                 &_depthImage.allocation, nullptr);
 
-  // build a image-view for the draw image to use for rendering
-  VkImageViewCreateInfo dview_info = vkinit::imageview_create_info(
-      _depthImage.imageFormat, _depthImage.image, VK_IMAGE_ASPECT_DEPTH_BIT);
-
-  VK_CHECK(
-      vkCreateImageView(_device, &dview_info, nullptr, &_depthImage.imageView));
+  _frameCapture.init(_allocator, drawImageExtent, _drawImage.imageFormat,
+                     (uint32_t)_frames.size());
 
   // add to deletion queues
   _mainDeletionQueue.push_function([this]() {
-    vkDestroyImageView(_device, _drawImage.imageView, nullptr);
-    vmaDestroyImage(_allocator, _drawImage.image, _drawImage.allocation);
-    vkDestroyImageView(_device, _depthImage.imageView, nullptr);
-    vmaDestroyImage(_allocator, _depthImage.image, _depthImage.allocation);
+    _frameCapture.destroy();
+    for (const AllocatedImage &drawImage : _drawImages) {
+      vkDestroyImageView(_device, drawImage.imageView, nullptr);
+      vmaDestroyImage(_allocator, drawImage.image, drawImage.allocation);
+    }
   });
 }
 //< init_swap
@@ -604,17 +1404,53 @@ void VulkanEngine::impl::init_commands() {
   VkCommandPoolCreateInfo commandPoolInfo = vkinit::command_pool_create_info(
       _graphicsQueueFamily, VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT);
 
-  for (int i = 0; i < FRAME_OVERLAP; i++) {
+  for (FrameData &frame : _frames) {
 
     VK_CHECK(vkCreateCommandPool(_device, &commandPoolInfo, nullptr,
-                                 &_frames[i]._commandPool));
+                                 &frame._commandPool));
 
     // allocate the default command buffer that we will use for rendering
     VkCommandBufferAllocateInfo cmdAllocInfo =
-        vkinit::command_buffer_allocate_info(_frames[i]._commandPool, 1);
+        vkinit::command_buffer_allocate_info(frame._commandPool, 1);
 
     VK_CHECK(vkAllocateCommandBuffers(_device, &cmdAllocInfo,
-                                      &_frames[i]._mainCommandBuffer));
+                                      &frame._mainCommandBuffer));
+  }
+
+  // the compute queue family is the graphics one without async compute, the
+  // buffers are only used with it
+  VkCommandPoolCreateInfo computePoolInfo = vkinit::command_pool_create_info(
+      _computeQueueFamily, VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT);
+
+  for (FrameData &frame : _frames) {
+    VK_CHECK(vkCreateCommandPool(_device, &computePoolInfo, nullptr,
+                                 &frame._computePool));
+
+    VkCommandBufferAllocateInfo cmdAllocInfo =
+        vkinit::command_buffer_allocate_info(frame._computePool, 1);
+    VK_CHECK(vkAllocateCommandBuffers(_device, &cmdAllocInfo,
+                                      &frame._computeCommandBuffer));
+  }
+
+  // the recording pools are reset as a whole every frame
+  _maxRecordThreads = (int)std::clamp(_jobs.thread_count(), 1u, 16u);
+  VkCommandPoolCreateInfo recordPoolInfo = vkinit::command_pool_create_info(
+      _graphicsQueueFamily, VK_COMMAND_POOL_CREATE_TRANSIENT_BIT);
+
+  for (FrameData &frame : _frames) {
+    // the extra one is recorded by the main thread
+    frame._recordPools.resize(_maxRecordThreads + 1);
+    frame._recordCommandBuffers.resize(_maxRecordThreads + 1);
+    for (size_t t = 0; t < frame._recordPools.size(); ++t) {
+      VK_CHECK(vkCreateCommandPool(_device, &recordPoolInfo, nullptr,
+                                   &frame._recordPools[t]));
+
+      VkCommandBufferAllocateInfo secondaryAllocInfo =
+          vkinit::command_buffer_allocate_info(frame._recordPools[t], 1);
+      secondaryAllocInfo.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+      VK_CHECK(vkAllocateCommandBuffers(_device, &secondaryAllocInfo,
+                                        &frame._recordCommandBuffers[t]));
+    }
   }
 
   // imgui command pool
@@ -636,22 +1472,33 @@ void VulkanEngine::impl::init_commands() {
 //> init_sync
 void VulkanEngine::impl::init_sync_structures() {
   // create syncronization structures
-  // one fence to control when the gpu has finished rendering the frame,
-  // and 2 semaphores to syncronize rendering with swapchain
-  // we want the fence to start signalled so we can wait on it on the first
-  // frame
-  VkFenceCreateInfo fenceCreateInfo =
-      vkinit::fence_create_info(VK_FENCE_CREATE_SIGNALED_BIT);
+  // frames are paced by one timeline semaphore per queue, the swapchain
+  // still needs a binary semaphore per frame to signal the acquire
   VkSemaphoreCreateInfo semaphoreCreateInfo = vkinit::semaphore_create_info();
 
-  for (int i = 0; i < FRAME_OVERLAP; i++) {
-    VK_CHECK(vkCreateFence(_device, &fenceCreateInfo, nullptr,
-                           &_frames[i]._renderFence));
-
+  for (FrameData &frame : _frames) {
     VK_CHECK(vkCreateSemaphore(_device, &semaphoreCreateInfo, nullptr,
-                               &_frames[i]._swapchainSemaphore));
+                               &frame._swapchainSemaphore));
   }
 
+  VkSemaphoreTypeCreateInfo timelineInfo{
+      .sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO};
+  timelineInfo.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+  timelineInfo.initialValue = 0;
+  VkSemaphoreCreateInfo timelineCreateInfo = vkinit::semaphore_create_info();
+  timelineCreateInfo.pNext = &timelineInfo;
+  VK_CHECK(vkCreateSemaphore(_device, &timelineCreateInfo, nullptr,
+                             &_graphicsTimeline));
+  VK_CHECK(vkCreateSemaphore(_device, &timelineCreateInfo, nullptr,
+                             &_computeTimeline));
+  _mainDeletionQueue.push_function([this]() {
+    vkDestroySemaphore(_device, _graphicsTimeline, nullptr);
+    vkDestroySemaphore(_device, _computeTimeline, nullptr);
+  });
+
+  // immediate submits block on their own fence
+  VkFenceCreateInfo fenceCreateInfo =
+      vkinit::fence_create_info(VK_FENCE_CREATE_SIGNALED_BIT);
   VK_CHECK(vkCreateFence(_device, &fenceCreateInfo, nullptr, &_immFence));
   _mainDeletionQueue.push_function(
       [this]() { vkDestroyFence(_device, _immFence, nullptr); });
@@ -661,9 +1508,11 @@ void VulkanEngine::impl::init_sync_structures() {
 void VulkanEngine::impl::init_descriptors() {
   // create a descriptor pool that will hold 10 sets with 1 image each
   std::vector<DescriptorAllocator::PoolSizeRatio> sizes = {
-      {VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1}};
+      {VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1},
+      {VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 3},
+      {VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1}};
 
-  globalDescriptorAllocator.init_pool(_device, 10, sizes);
+  globalDescriptorAllocator.init_pool(_device, 32, sizes);
 
   // make the descriptor set layout for our compute draw
   {
@@ -673,25 +1522,50 @@ void VulkanEngine::impl::init_descriptors() {
         builder.build(_device, VK_SHADER_STAGE_COMPUTE_BIT);
   }
 
-  // allocate a descriptor set for our draw image
-  _drawImageDescriptors =
-      globalDescriptorAllocator.allocate(_device, _drawImageDescriptorLayout);
+  // allocate a descriptor set for each draw image
+  for (const AllocatedImage &drawImage : _drawImages) {
+    VkDescriptorSet set =
+        globalDescriptorAllocator.allocate(_device, _drawImageDescriptorLayout);
+    _drawImageSets.push_back(set);
 
-  VkDescriptorImageInfo imgInfo{};
-  imgInfo.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
-  imgInfo.imageView = _drawImage.imageView;
+    VkDescriptorImageInfo imgInfo{};
+    imgInfo.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+    imgInfo.imageView = drawImage.imageView;
 
-  VkWriteDescriptorSet drawImageWrite = {};
-  drawImageWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-  drawImageWrite.pNext = nullptr;
+    VkWriteDescriptorSet drawImageWrite = {};
+    drawImageWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    drawImageWrite.pNext = nullptr;
 
-  drawImageWrite.dstBinding = 0;
-  drawImageWrite.dstSet = _drawImageDescriptors;
-  drawImageWrite.descriptorCount = 1;
-  drawImageWrite.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
-  drawImageWrite.pImageInfo = &imgInfo;
+    drawImageWrite.dstBinding = 0;
+    drawImageWrite.dstSet = set;
+    drawImageWrite.descriptorCount = 1;
+    drawImageWrite.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+    drawImageWrite.pImageInfo = &imgInfo;
+
+    vkUpdateDescriptorSets(_device, 1, &drawImageWrite, 0, nullptr);
+  }
+  _drawImageDescriptors = _drawImageSets[0];
 
-  vkUpdateDescriptorSets(_device, 1, &drawImageWrite, 0, nullptr);
+  // objects, draw commands and draw counts of the culling pass. the set
+  // itself is written by init_scene once the buffers exist
+  {
+    DescriptorLayoutBuilder builder;
+    builder.add_binding(0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+    builder.add_binding(1, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+    builder.add_binding(2, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+    builder.add_binding(3, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+    builder.add_binding(4, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
+    _cullDescriptorLayout = builder.build(_device, VK_SHADER_STAGE_COMPUTE_BIT);
+  }
+
+  // one level of the depth pyramid
+  {
+    DescriptorLayoutBuilder builder;
+    builder.add_binding(0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
+    builder.add_binding(1, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE);
+    _depthReduceDescriptorLayout =
+        builder.build(_device, VK_SHADER_STAGE_COMPUTE_BIT);
+  }
 
   // make sure both the descriptor allocator and the new layout get cleaned up
   // properly
@@ -699,16 +1573,204 @@ void VulkanEngine::impl::init_descriptors() {
     globalDescriptorAllocator.destroy_pool(_device);
 
     vkDestroyDescriptorSetLayout(_device, _drawImageDescriptorLayout, nullptr);
+    vkDestroyDescriptorSetLayout(_device, _cullDescriptorLayout, nullptr);
+    vkDestroyDescriptorSetLayout(_device, _depthReduceDescriptorLayout,
+                                 nullptr);
   });
 }
 
+void VulkanEngine::impl::init_depth_pyramid() {
+  // round down so every level halves exactly
+  auto previous_pow2 = [](uint32_t v) {
+    uint32_t r = 1;
+    while (r * 2 <= v) {
+      r *= 2;
+    }
+    return r;
+  };
+  _depthPyramidExtent = {previous_pow2(_drawImage.imageExtent.width),
+                         previous_pow2(_drawImage.imageExtent.height)};
+  _depthPyramidLevels = 1;
+  while ((std::max(_depthPyramidExtent.width, _depthPyramidExtent.height) >>
+          _depthPyramidLevels) > 0) {
+    _depthPyramidLevels++;
+  }
+
+  // transient like the depth image, created by the render graph
+  _depthPyramid.imageFormat = VK_FORMAT_R32_SFLOAT;
+  _depthPyramid.imageExtent = {_depthPyramidExtent.width,
+                               _depthPyramidExtent.height, 1};
+
+  // linear filtering with a min reduction returns the farthest of the
+  // texels under the footprint, reversed depth makes that the minimum
+  VkSamplerReductionModeCreateInfo reductionInfo{
+      .sType = VK_STRUCTURE_TYPE_SAMPLER_REDUCTION_MODE_CREATE_INFO};
+  reductionInfo.reductionMode = VK_SAMPLER_REDUCTION_MODE_MIN;
+
+  VkSamplerCreateInfo samplerInfo{.sType =
+                                      VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO};
+  samplerInfo.pNext = &reductionInfo;
+  samplerInfo.magFilter = VK_FILTER_LINEAR;
+  samplerInfo.minFilter = VK_FILTER_LINEAR;
+  samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+  samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+  samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+  samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+  samplerInfo.minLod = 0.f;
+  samplerInfo.maxLod = VK_LOD_CLAMP_NONE;
+  VK_CHECK(vkCreateSampler(_device, &samplerInfo, nullptr,
+                           &_depthReductionSampler));
+
+  // written by create_transient_views() once the images exist
+  _depthReduceDescriptors.resize(_depthPyramidLevels);
+  for (uint32_t i = 0; i < _depthPyramidLevels; ++i) {
+    _depthReduceDescriptors[i] = globalDescriptorAllocator.allocate(
+        _device, _depthReduceDescriptorLayout);
+  }
+
+  _mainDeletionQueue.push_function([this]() {
+    vkDestroySampler(_device, _depthReductionSampler, nullptr);
+    destroy_transient_views();
+  });
+}
+
+void VulkanEngine::impl::create_transient_views() {
+  destroy_transient_views();
+
+  VkImageViewCreateInfo depthViewInfo = vkinit::imageview_create_info(
+      _depthImage.imageFormat, _depthImage.image, VK_IMAGE_ASPECT_DEPTH_BIT);
+  VK_CHECK(vkCreateImageView(_device, &depthViewInfo, nullptr,
+                             &_depthImage.imageView));
+
+  // the whole chain for the culling pass, and one view per level to write
+  VkImageViewCreateInfo view_info = vkinit::imageview_create_info(
+      _depthPyramid.imageFormat, _depthPyramid.image,
+      VK_IMAGE_ASPECT_COLOR_BIT);
+  view_info.subresourceRange.levelCount = _depthPyramidLevels;
+  VK_CHECK(vkCreateImageView(_device, &view_info, nullptr,
+                             &_depthPyramid.imageView));
+
+  _depthPyramidMips.resize(_depthPyramidLevels);
+  for (uint32_t i = 0; i < _depthPyramidLevels; ++i) {
+    view_info.subresourceRange.baseMipLevel = i;
+    view_info.subresourceRange.levelCount = 1;
+    VK_CHECK(vkCreateImageView(_device, &view_info, nullptr,
+                               &_depthPyramidMips[i]));
+  }
+
+  for (uint32_t i = 0; i < _depthPyramidLevels; ++i) {
+    VkDescriptorImageInfo srcInfo{};
+    srcInfo.sampler = _depthReductionSampler;
+    srcInfo.imageView =
+        i == 0 ? _depthImage.imageView : _depthPyramidMips[i - 1];
+    srcInfo.imageLayout = i == 0 ? VK_IMAGE_LAYOUT_DEPTH_READ_ONLY_OPTIMAL
+                                 : VK_IMAGE_LAYOUT_GENERAL;
+
+    VkDescriptorImageInfo dstInfo{};
+    dstInfo.imageView = _depthPyramidMips[i];
+    dstInfo.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+
+    VkWriteDescriptorSet writes[2] = {};
+    for (uint32_t b = 0; b < 2; ++b) {
+      writes[b].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+      writes[b].dstSet = _depthReduceDescriptors[i];
+      writes[b].dstBinding = b;
+      writes[b].descriptorCount = 1;
+    }
+    writes[0].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    writes[0].pImageInfo = &srcInfo;
+    writes[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+    writes[1].pImageInfo = &dstInfo;
+
+    vkUpdateDescriptorSets(_device, 2, writes, 0, nullptr);
+  }
+
+  VkDescriptorImageInfo pyramidInfo{};
+  pyramidInfo.sampler = _depthReductionSampler;
+  pyramidInfo.imageView = _depthPyramid.imageView;
+  pyramidInfo.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+
+  VkWriteDescriptorSet pyramidWrite{
+      .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET};
+  pyramidWrite.dstSet = _cullDescriptors;
+  pyramidWrite.dstBinding = 4;
+  pyramidWrite.descriptorCount = 1;
+  pyramidWrite.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+  pyramidWrite.pImageInfo = &pyramidInfo;
+  vkUpdateDescriptorSets(_device, 1, &pyramidWrite, 0, nullptr);
+
+  const RenderGraph::TransientMemory &memory = _renderGraph.transientMemory;
+  fmt::println("Transient images: {:.2f} MiB aliased in one block instead of "
+               "{:.2f} MiB dedicated",
+               memory.aliased / (1024.0 * 1024.0),
+               memory.dedicated / (1024.0 * 1024.0));
+}
+
+void VulkanEngine::impl::destroy_transient_views() {
+  for (VkImageView view : _depthPyramidMips) {
+    vkDestroyImageView(_device, view, nullptr);
+  }
+  _depthPyramidMips.clear();
+  vkDestroyImageView(_device, _depthPyramid.imageView, nullptr);
+  vkDestroyImageView(_device, _depthImage.imageView, nullptr);
+  _depthPyramid.imageView = VK_NULL_HANDLE;
+  _depthImage.imageView = VK_NULL_HANDLE;
+}
+
 void VulkanEngine::impl::init_pipelines() {
-  init_background_pipelines();
-  init_triangle_pipeline();
-  init_mesh_pipeline();
+  auto start = std::chrono::steady_clock::now();
+
+  // load every shader module once, the pipelines below share them
+  ShaderModules shaders;
+  for (const char *path : {
+           "shaders/gradient_color.comp.spv",
+           "shaders/sky.comp.spv",
+           "shaders/colored_triangle.vert.spv",
+           "shaders/colored_triangle.frag.spv",
+           mesh_vertex_shader(VERTEX_FORMAT),
+           indirect_vertex_shader(VERTEX_FORMAT),
+           "shaders/cull.comp.spv",
+           "shaders/depth_reduce.comp.spv",
+       }) {
+    VkShaderModule module;
+    if (!vkutil::load_shader_module(path, _device, &module)) {
+      fmt::println("Error when building the shader module {}", path);
+      module = VK_NULL_HANDLE;
+    }
+    shaders[path] = module;
+  }
+
+  // the init functions create the layouts and describe their pipelines, then
+  // every pipeline compiles as its own job. the pipeline cache is internally
+  // synchronized so they can all share it
+  PipelineBuilds builds;
+  init_background_pipelines(shaders, builds);
+  init_triangle_pipeline(shaders, builds);
+  init_mesh_pipeline(shaders, builds);
+  init_scene_pipelines(shaders, builds);
+
+  JobHandle building =
+      _jobs.parallel_for(builds.size(), 1, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+          builds[i]();
+        }
+      });
+  _jobs.wait(building);
+
+  // clean structures
+  for (auto &[path, module] : shaders) {
+    vkDestroyShaderModule(_device, module, nullptr);
+  }
+
+  auto end = std::chrono::steady_clock::now();
+  fmt::println("Built {} pipelines in {:.2f} ms with a {} pipeline cache",
+               builds.size(),
+               std::chrono::duration<double, std::milli>(end - start).count(),
+               _pipelineCacheWarm ? "warm" : "cold");
 }
 
-void VulkanEngine::impl::init_background_pipelines() {
+void VulkanEngine::impl::init_background_pipelines(const ShaderModules &shaders,
+                                                   PipelineBuilds &builds) {
   VkPipelineLayoutCreateInfo computeLayout{};
   computeLayout.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
   computeLayout.pNext = nullptr;
@@ -726,32 +1788,6 @@ void VulkanEngine::impl::init_background_pipelines() {
   VK_CHECK(vkCreatePipelineLayout(_device, &computeLayout, nullptr,
                                   &_gradientPipelineLayout));
 
-  VkShaderModule gradientShader;
-  if (!vkutil::load_shader_module("shaders/gradient_color.comp.spv", _device,
-                                  &gradientShader)) {
-    fmt::println("Error when building the compute shader \n");
-  }
-
-  VkShaderModule skyShader;
-  if (!vkutil::load_shader_module("shaders/sky.comp.spv", _device,
-                                  &skyShader)) {
-    fmt::println("Error when building the compute shader \n");
-  }
-
-  VkPipelineShaderStageCreateInfo stageinfo{};
-  stageinfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-  stageinfo.pNext = nullptr;
-  stageinfo.stage = VK_SHADER_STAGE_COMPUTE_BIT;
-  stageinfo.module = gradientShader;
-  stageinfo.pName = "main";
-
-  VkComputePipelineCreateInfo computePipelineCreateInfo{};
-  computePipelineCreateInfo.sType =
-      VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
-  computePipelineCreateInfo.pNext = nullptr;
-  computePipelineCreateInfo.layout = _gradientPipelineLayout;
-  computePipelineCreateInfo.stage = stageinfo;
-
   ComputeEffect gradient;
   gradient.layout = _gradientPipelineLayout;
   gradient.name = "gradient";
@@ -761,13 +1797,6 @@ void VulkanEngine::impl::init_background_pipelines() {
   gradient.data.data1 = glm::vec4(1, 0, 0, 1);
   gradient.data.data2 = glm::vec4(0, 0, 1, 1);
 
-  VK_CHECK(vkCreateComputePipelines(_device, VK_NULL_HANDLE, 1,
-                                    &computePipelineCreateInfo, nullptr,
-                                    &gradient.pipeline));
-
-  // change the shader module only to create the sky shader
-  computePipelineCreateInfo.stage.module = skyShader;
-
   ComputeEffect sky;
   sky.layout = _gradientPipelineLayout;
   sky.name = "sky";
@@ -775,41 +1804,48 @@ void VulkanEngine::impl::init_background_pipelines() {
   // default sky parameters
   sky.data.data1 = glm::vec4(0.1, 0.2, 0.4, 0.97);
 
-  VK_CHECK(vkCreateComputePipelines(_device, VK_NULL_HANDLE, 1,
-                                    &computePipelineCreateInfo, nullptr,
-                                    &sky.pipeline));
-
-  // add the 2 background effects into the array
+  // add the 2 background effects into the array. the pipelines are filled in
+  // by the builds below, so the array must not grow until they are done
   backgroundEffects.push_back(gradient);
   backgroundEffects.push_back(sky);
 
+  const VkShaderModule effectShaders[] = {
+      shaders.at("shaders/gradient_color.comp.spv"),
+      shaders.at("shaders/sky.comp.spv")};
+
+  for (size_t i = 0; i < std::size(effectShaders); ++i) {
+    builds.push_back([this, i, module = effectShaders[i]]() {
+      VkPipelineShaderStageCreateInfo stageinfo{};
+      stageinfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+      stageinfo.pNext = nullptr;
+      stageinfo.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+      stageinfo.module = module;
+      stageinfo.pName = "main";
+
+      VkComputePipelineCreateInfo computePipelineCreateInfo{};
+      computePipelineCreateInfo.sType =
+          VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+      computePipelineCreateInfo.pNext = nullptr;
+      computePipelineCreateInfo.layout = _gradientPipelineLayout;
+      computePipelineCreateInfo.stage = stageinfo;
+
+      VK_CHECK(vkCreateComputePipelines(_device, _pipelineCache, 1,
+                                        &computePipelineCreateInfo, nullptr,
+                                        &backgroundEffects[i].pipeline));
+    });
+  }
+
   // destroy structures properly
-  vkDestroyShaderModule(_device, gradientShader, nullptr);
-  vkDestroyShaderModule(_device, skyShader, nullptr);
-  _mainDeletionQueue.push_function([this, sky, gradient]() {
+  _mainDeletionQueue.push_function([this]() {
     vkDestroyPipelineLayout(_device, _gradientPipelineLayout, nullptr);
-    vkDestroyPipeline(_device, sky.pipeline, nullptr);
-    vkDestroyPipeline(_device, gradient.pipeline, nullptr);
+    for (ComputeEffect &effect : backgroundEffects) {
+      vkDestroyPipeline(_device, effect.pipeline, nullptr);
+    }
   });
 }
 
-void VulkanEngine::impl::init_triangle_pipeline() {
-  VkShaderModule triangleFragShader;
-  if (!vkutil::load_shader_module("shaders/colored_triangle.frag.spv", _device,
-                                  &triangleFragShader)) {
-    fmt::println("Error when building the triangle fragment shader module");
-  } else {
-    fmt::println("Triangle fragment shader succesfully loaded");
-  }
-
-  VkShaderModule triangleVertexShader;
-  if (!vkutil::load_shader_module("shaders/colored_triangle.vert.spv", _device,
-                                  &triangleVertexShader)) {
-    fmt::println("Error when building the triangle vertex shader module");
-  } else {
-    fmt::println("Triangle vertex shader succesfully loaded");
-  }
-
+void VulkanEngine::impl::init_triangle_pipeline(const ShaderModules &shaders,
+                                                PipelineBuilds &builds) {
   // build the pipeline layout that controls the inputs/outputs of the shader
   // we are not using descriptor sets or other systems yet, so no need to use
   // anything other than empty default
@@ -818,35 +1854,37 @@ void VulkanEngine::impl::init_triangle_pipeline() {
   VK_CHECK(vkCreatePipelineLayout(_device, &pipeline_layout_info, nullptr,
                                   &_trianglePipelineLayout));
 
-  vkutil::PipelineBuilder pipelineBuilder;
+  // the builder points into itself, so it lives on the heap until the build
+  // has run
+  auto pipelineBuilder = std::make_shared<vkutil::PipelineBuilder>();
 
   // use the triangle layout we created
-  pipelineBuilder._pipelineLayout = _trianglePipelineLayout;
+  pipelineBuilder->_pipelineLayout = _trianglePipelineLayout;
   // connecting the vertex and pixel shaders to the pipeline
-  pipelineBuilder.set_shaders(triangleVertexShader, triangleFragShader);
+  pipelineBuilder->set_shaders(shaders.at("shaders/colored_triangle.vert.spv"),
+                               shaders.at("shaders/colored_triangle.frag.spv"));
   // it will draw triangles
-  pipelineBuilder.set_input_topology(VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST);
+  pipelineBuilder->set_input_topology(VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST);
   // filled triangles
-  pipelineBuilder.set_polygon_mode(VK_POLYGON_MODE_FILL);
+  pipelineBuilder->set_polygon_mode(VK_POLYGON_MODE_FILL);
   // no backface culling
-  pipelineBuilder.set_cull_mode(VK_CULL_MODE_NONE, VK_FRONT_FACE_CLOCKWISE);
+  pipelineBuilder->set_cull_mode(VK_CULL_MODE_NONE, VK_FRONT_FACE_CLOCKWISE);
   // no multisampling
-  pipelineBuilder.set_multisampling_none();
+  pipelineBuilder->set_multisampling_none();
   // no blending
-  pipelineBuilder.disable_blending();
+  pipelineBuilder->disable_blending();
   // no depth testing
-  pipelineBuilder.disable_depthtest();
+  pipelineBuilder->disable_depthtest();
 
   // connect the image format we will draw into, from draw image
-  pipelineBuilder.set_color_attachment_format(_drawImage.imageFormat);
-  pipelineBuilder.set_depth_format(_depthImage.imageFormat);
+  pipelineBuilder->set_color_attachment_format(_drawImage.imageFormat);
+  pipelineBuilder->set_depth_format(_depthImage.imageFormat);
 
   // finally build the pipeline
-  _trianglePipeline = pipelineBuilder.build_pipeline(_device);
-
-  // clean structures
-  vkDestroyShaderModule(_device, triangleFragShader, nullptr);
-  vkDestroyShaderModule(_device, triangleVertexShader, nullptr);
+  builds.push_back([this, pipelineBuilder]() {
+    _trianglePipeline =
+        pipelineBuilder->build_pipeline(_device, _pipelineCache);
+  });
 
   _mainDeletionQueue.push_function([&]() {
     vkDestroyPipelineLayout(_device, _trianglePipelineLayout, nullptr);
@@ -854,23 +1892,8 @@ void VulkanEngine::impl::init_triangle_pipeline() {
   });
 }
 
-void VulkanEngine::impl::init_mesh_pipeline() {
-  VkShaderModule triangleFragShader;
-  if (!vkutil::load_shader_module("shaders/colored_triangle.frag.spv", _device,
-                                  &triangleFragShader)) {
-    fmt::println("Error when building the triangle fragment shader module");
-  } else {
-    fmt::println("Triangle fragment shader succesfully loaded");
-  }
-
-  VkShaderModule triangleVertexShader;
-  if (!vkutil::load_shader_module("shaders/colored_triangle_mesh.vert.spv",
-                                  _device, &triangleVertexShader)) {
-    fmt::println("Error when building the triangle vertex shader module");
-  } else {
-    fmt::println("Triangle vertex shader succesfully loaded");
-  }
-
+void VulkanEngine::impl::init_mesh_pipeline(const ShaderModules &shaders,
+                                            PipelineBuilds &builds) {
   VkPushConstantRange bufferRange{};
   bufferRange.offset = 0;
   bufferRange.size = sizeof(GPUDrawPushConstants);
@@ -884,34 +1907,34 @@ void VulkanEngine::impl::init_mesh_pipeline() {
   VK_CHECK(vkCreatePipelineLayout(_device, &pipeline_layout_info, nullptr,
                                   &_meshPipelineLayout));
 
-  vkutil::PipelineBuilder pipelineBuilder;
+  auto pipelineBuilder = std::make_shared<vkutil::PipelineBuilder>();
 
   // use the triangle layout we created
-  pipelineBuilder._pipelineLayout = _meshPipelineLayout;
+  pipelineBuilder->_pipelineLayout = _meshPipelineLayout;
   // connecting the vertex and pixel shaders to the pipeline
-  pipelineBuilder.set_shaders(triangleVertexShader, triangleFragShader);
+  pipelineBuilder->set_shaders(
+      shaders.at(mesh_vertex_shader(VERTEX_FORMAT)),
+      shaders.at("shaders/colored_triangle.frag.spv"));
   // it will draw triangles
-  pipelineBuilder.set_input_topology(VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST);
+  pipelineBuilder->set_input_topology(VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST);
   // filled triangles
-  pipelineBuilder.set_polygon_mode(VK_POLYGON_MODE_FILL);
+  pipelineBuilder->set_polygon_mode(VK_POLYGON_MODE_FILL);
   // no backface culling
-  pipelineBuilder.set_cull_mode(VK_CULL_MODE_NONE, VK_FRONT_FACE_CLOCKWISE);
+  pipelineBuilder->set_cull_mode(VK_CULL_MODE_NONE, VK_FRONT_FACE_CLOCKWISE);
   // no multisampling
-  pipelineBuilder.set_multisampling_none();
+  pipelineBuilder->set_multisampling_none();
   // no blending
-  pipelineBuilder.disable_blending();
-  pipelineBuilder.enable_depthtest(true, VK_COMPARE_OP_GREATER_OR_EQUAL);
+  pipelineBuilder->disable_blending();
+  pipelineBuilder->enable_depthtest(true, VK_COMPARE_OP_GREATER_OR_EQUAL);
 
   // connect the image format we will draw into, from draw image
-  pipelineBuilder.set_color_attachment_format(_drawImage.imageFormat);
-  pipelineBuilder.set_depth_format(_depthImage.imageFormat);
+  pipelineBuilder->set_color_attachment_format(_drawImage.imageFormat);
+  pipelineBuilder->set_depth_format(_depthImage.imageFormat);
 
   // finally build the pipeline
-  _meshPipeline = pipelineBuilder.build_pipeline(_device);
-
-  // clean structures
-  vkDestroyShaderModule(_device, triangleFragShader, nullptr);
-  vkDestroyShaderModule(_device, triangleVertexShader, nullptr);
+  builds.push_back([this, pipelineBuilder]() {
+    _meshPipeline = pipelineBuilder->build_pipeline(_device, _pipelineCache);
+  });
 
   _mainDeletionQueue.push_function([&]() {
     vkDestroyPipelineLayout(_device, _meshPipelineLayout, nullptr);
@@ -919,6 +1942,118 @@ void VulkanEngine::impl::init_mesh_pipeline() {
   });
 }
 
+void VulkanEngine::impl::init_scene_pipelines(const ShaderModules &shaders,
+                                              PipelineBuilds &builds) {
+  // culling pass
+  VkPushConstantRange cullRange{};
+  cullRange.offset = 0;
+  cullRange.size = sizeof(GPUCullPushConstants);
+  cullRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+  VkPipelineLayoutCreateInfo cullLayout = vkinit::pipeline_layout_create_info();
+  cullLayout.pSetLayouts = &_cullDescriptorLayout;
+  cullLayout.setLayoutCount = 1;
+  cullLayout.pPushConstantRanges = &cullRange;
+  cullLayout.pushConstantRangeCount = 1;
+
+  VK_CHECK(vkCreatePipelineLayout(_device, &cullLayout, nullptr,
+                                  &_cullPipelineLayout));
+
+  builds.push_back([this, module = shaders.at("shaders/cull.comp.spv")]() {
+    VkPipelineShaderStageCreateInfo stageinfo{};
+    stageinfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    stageinfo.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+    stageinfo.module = module;
+    stageinfo.pName = "main";
+
+    VkComputePipelineCreateInfo computePipelineCreateInfo{};
+    computePipelineCreateInfo.sType =
+        VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+    computePipelineCreateInfo.layout = _cullPipelineLayout;
+    computePipelineCreateInfo.stage = stageinfo;
+
+    VK_CHECK(vkCreateComputePipelines(_device, _pipelineCache, 1,
+                                      &computePipelineCreateInfo, nullptr,
+                                      &_cullPipeline));
+  });
+
+  // depth pyramid reduction
+  VkPushConstantRange reduceRange{};
+  reduceRange.offset = 0;
+  reduceRange.size = sizeof(glm::vec2);
+  reduceRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+  VkPipelineLayoutCreateInfo reduceLayout =
+      vkinit::pipeline_layout_create_info();
+  reduceLayout.pSetLayouts = &_depthReduceDescriptorLayout;
+  reduceLayout.setLayoutCount = 1;
+  reduceLayout.pPushConstantRanges = &reduceRange;
+  reduceLayout.pushConstantRangeCount = 1;
+
+  VK_CHECK(vkCreatePipelineLayout(_device, &reduceLayout, nullptr,
+                                  &_depthReducePipelineLayout));
+
+  builds.push_back(
+      [this, module = shaders.at("shaders/depth_reduce.comp.spv")]() {
+        VkPipelineShaderStageCreateInfo stageinfo{};
+        stageinfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+        stageinfo.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+        stageinfo.module = module;
+        stageinfo.pName = "main";
+
+        VkComputePipelineCreateInfo computePipelineCreateInfo{};
+        computePipelineCreateInfo.sType =
+            VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+        computePipelineCreateInfo.layout = _depthReducePipelineLayout;
+        computePipelineCreateInfo.stage = stageinfo;
+
+        VK_CHECK(vkCreateComputePipelines(_device, _pipelineCache, 1,
+                                          &computePipelineCreateInfo, nullptr,
+                                          &_depthReducePipeline));
+      });
+
+  // indirect draws, same state as the mesh pipeline
+  VkPushConstantRange drawRange{};
+  drawRange.offset = 0;
+  drawRange.size = sizeof(GPUSceneDrawPushConstants);
+  drawRange.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+
+  VkPipelineLayoutCreateInfo drawLayout = vkinit::pipeline_layout_create_info();
+  drawLayout.pPushConstantRanges = &drawRange;
+  drawLayout.pushConstantRangeCount = 1;
+
+  VK_CHECK(vkCreatePipelineLayout(_device, &drawLayout, nullptr,
+                                  &_indirectPipelineLayout));
+
+  auto pipelineBuilder = std::make_shared<vkutil::PipelineBuilder>();
+  pipelineBuilder->_pipelineLayout = _indirectPipelineLayout;
+  pipelineBuilder->set_shaders(
+      shaders.at(indirect_vertex_shader(VERTEX_FORMAT)),
+      shaders.at("shaders/colored_triangle.frag.spv"));
+  pipelineBuilder->set_input_topology(VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST);
+  pipelineBuilder->set_polygon_mode(VK_POLYGON_MODE_FILL);
+  pipelineBuilder->set_cull_mode(VK_CULL_MODE_NONE, VK_FRONT_FACE_CLOCKWISE);
+  pipelineBuilder->set_multisampling_none();
+  pipelineBuilder->disable_blending();
+  pipelineBuilder->enable_depthtest(true, VK_COMPARE_OP_GREATER_OR_EQUAL);
+  pipelineBuilder->set_color_attachment_format(_drawImage.imageFormat);
+  pipelineBuilder->set_depth_format(_depthImage.imageFormat);
+
+  builds.push_back([this, pipelineBuilder]() {
+    _indirectPipeline =
+        pipelineBuilder->build_pipeline(_device, _pipelineCache);
+  });
+
+  _mainDeletionQueue.push_function([&]() {
+    vkDestroyPipelineLayout(_device, _cullPipelineLayout, nullptr);
+    vkDestroyPipeline(_device, _cullPipeline, nullptr);
+    vkDestroyPipelineLayout(_device, _indirectPipelineLayout, nullptr);
+    vkDestroyPipeline(_device, _indirectPipeline, nullptr);
+    vkDestroyPipelineLayout(_device, _depthReducePipelineLayout, nullptr);
+    vkDestroyPipeline(_device, _depthReducePipeline, nullptr);
+  });
+}
+
 void VulkanEngine::impl::init_default_data() {
   std::array<Vertex, 4> rect_vertices;
 
@@ -942,15 +2077,167 @@ void VulkanEngine::impl::init_default_data() {
   rect_indices[4] = 1;
   rect_indices[5] = 3;
 
-  rectangle = uploadMesh(rect_indices, rect_vertices);
+  MeshUploadInfo rect_upload{.indices = rect_indices,
+                             .vertices = rect_vertices};
+  rectangle = uploadMeshes({&rect_upload, 1}).front();
 
   // delete the rectangle data on engine shutdown
-  _mainDeletionQueue.push_function([&]() {
-    destroy_buffer(rectangle.indexBuffer);
-    destroy_buffer(rectangle.vertexBuffer);
-  });
+  _mainDeletionQueue.push_function([&]() { _geometryPool.free(rectangle); });
+
+  if (_defaultScene) {
+    testMeshes =
+        loadGltfMeshes(_parent, "assets/basicmesh.glb", {.jobs = &_jobs})
+            .value();
+  }
+}
+
+void VulkanEngine::impl::add_object(const MeshAsset &mesh,
+                                    const glm::mat4 &transform) {
+  const GPUMeshBuffers &buffers = mesh.meshBuffers;
+  // bounds can only grow with the largest scale of the transform
+  float scale = std::max({glm::length(glm::vec3{transform[0]}),
+                          glm::length(glm::vec3{transform[1]}),
+                          glm::length(glm::vec3{transform[2]})});
+
+  // the world box around a transformed box grows by the absolute values of
+  // the rotation and scale
+  glm::mat3 absolute{glm::abs(glm::vec3{transform[0]}),
+                     glm::abs(glm::vec3{transform[1]}),
+                     glm::abs(glm::vec3{transform[2]})};
+
+  for (const GeoSurface &surface : mesh.surfaces) {
+    glm::vec3 center = transform * glm::vec4{surface.bounds.origin, 1};
+    _cullingBounds.push_back(center, surface.bounds.sphereRadius * scale,
+                             absolute * surface.bounds.extents);
+
+    GPUObjectData object{};
+    object.renderMatrix = transform * dequantize_matrix(buffers);
+    object.sphereBounds =
+        glm::vec4{center, surface.bounds.sphereRadius * scale};
+    object.firstIndex = buffers.firstIndex + surface.startIndex;
+    object.indexCount = surface.count;
+    object.drawBucket = draw_bucket(buffers.indexType);
+    object.vertexBuffer = buffers.vertexBufferAddress;
+    _sceneObjects.push_back(object);
+  }
+}
+
+void VulkanEngine::impl::init_scene() {
+  // the monkey head the tutorial draws, then the grid behind it
+  add_object(*testMeshes[2], glm::mat4{1.f});
+  for (int z = 1; z <= SCENE_GRID_SIZE; ++z) {
+    for (int y = 0; y < SCENE_GRID_SIZE; ++y) {
+      for (int x = 0; x < SCENE_GRID_SIZE; ++x) {
+        glm::vec3 position =
+            glm::vec3{x - SCENE_GRID_SIZE / 2, y - SCENE_GRID_SIZE / 2, -z} *
+            SCENE_GRID_SPACING;
+        size_t mesh = (x + y + z) % testMeshes.size();
+        add_object(*testMeshes[mesh], glm::translate(position));
+      }
+    }
+  }
+
+  upload_scene();
+}
+
+void VulkanEngine::impl::set_scene(std::span<const SceneInstance> instances) {
+  if (_defaultScene || !_sceneObjects.empty()) {
+    fmt::println("The scene can only be set once, without the default scene");
+    abort();
+  }
+
+  for (const SceneInstance &instance : instances) {
+    add_object(*instance.mesh, instance.transform);
+  }
+  upload_scene();
+}
+
+void VulkanEngine::impl::upload_scene() {
+  size_t objectBytes = _sceneObjects.size() * sizeof(GPUObjectData);
+  _objectBuffer = create_buffer(objectBytes,
+                                VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+                                    VK_BUFFER_USAGE_TRANSFER_DST_BIT |
+                                    VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
+                                VMA_MEMORY_USAGE_GPU_ONLY, _sharedQueueFamilies);
+
+  VkBufferDeviceAddressInfo deviceAdressInfo{
+      .sType = VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO,
+      .buffer = _objectBuffer.buffer};
+  _objectBufferAddress = vkGetBufferDeviceAddress(_device, &deviceAdressInfo);
+
+  // every object could be visible, each bucket gets room for all of them
+  _drawCommandBuffer = create_buffer(
+      DRAW_BUCKET_COUNT * _sceneObjects.size() *
+          sizeof(VkDrawIndexedIndirectCommand),
+      VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT,
+      VMA_MEMORY_USAGE_GPU_ONLY);
+  _drawCountBuffer = create_buffer(
+      DRAW_BUCKET_COUNT * sizeof(uint32_t),
+      VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT |
+          VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+      VMA_MEMORY_USAGE_GPU_ONLY);
+
+  for (FrameData &frame : _frames) {
+    frame._indirectBuffer = create_buffer(
+        DRAW_BUCKET_COUNT * _sceneObjects.size() *
+            sizeof(VkDrawIndexedIndirectCommand),
+        VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU);
+    frame._cullStatsBuffer =
+        create_buffer(2 * DRAW_BUCKET_COUNT * sizeof(uint32_t),
+                      VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                      VMA_MEMORY_USAGE_GPU_TO_CPU);
+    frame._cullStatsPasses = 0;
+  }
+
+  _visibilityBuffer = create_buffer(
+      _sceneObjects.size() * sizeof(uint32_t),
+      VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+      VMA_MEMORY_USAGE_GPU_ONLY, _sharedQueueFamilies);
+
+  // the draws wait on the upload timeline like the meshes do. nothing counts
+  // as visible before the first late pass
+  std::vector<uint32_t> visibility(_sceneObjects.size(), 0);
+  _uploadManager.upload(_objectBuffer.buffer, 0, _sceneObjects.data(),
+                        objectBytes);
+  _uploadManager.upload(_visibilityBuffer.buffer, 0, visibility.data(),
+                        visibility.size() * sizeof(uint32_t));
+  _uploadManager.flush();
+
+  _cullDescriptors =
+      globalDescriptorAllocator.allocate(_device, _cullDescriptorLayout);
+
+  VkDescriptorBufferInfo bufferInfos[] = {
+      {_objectBuffer.buffer, 0, VK_WHOLE_SIZE},
+      {_drawCommandBuffer.buffer, 0, VK_WHOLE_SIZE},
+      {_drawCountBuffer.buffer, 0, VK_WHOLE_SIZE},
+      {_visibilityBuffer.buffer, 0, VK_WHOLE_SIZE},
+  };
+  VkWriteDescriptorSet writes[std::size(bufferInfos)];
+  for (uint32_t i = 0; i < std::size(bufferInfos); ++i) {
+    writes[i] = {.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET};
+    writes[i].dstSet = _cullDescriptors;
+    writes[i].dstBinding = i;
+    writes[i].descriptorCount = 1;
+    writes[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    writes[i].pBufferInfo = &bufferInfos[i];
+  }
 
-  testMeshes = loadGltfMeshes(_parent, "assets/basicmesh.glb").value();
+  // the depth pyramid binding follows the transient images, see
+  // create_transient_views()
+  vkUpdateDescriptorSets(_device, std::size(writes), writes, 0, nullptr);
+
+  fmt::println("Scene has {} objects", _sceneObjects.size());
+
+  _mainDeletionQueue.push_function([this]() {
+    for (FrameData &frame : _frames) {
+      destroy_buffer(frame._indirectBuffer);
+      destroy_buffer(frame._cullStatsBuffer);
+    }
+    destroy_buffer(_visibilityBuffer);
+    destroy_buffer(_drawCountBuffer);
+    destroy_buffer(_drawCommandBuffer);
+    destroy_buffer(_objectBuffer);
+  });
 }
 
 void VulkanEngine::impl::init_imgui() {
@@ -995,8 +2282,8 @@ void VulkanEngine::impl::init_imgui() {
   init_info.Device = _device;
   init_info.Queue = _graphicsQueue;
   init_info.DescriptorPool = imguiPool;
-  init_info.MinImageCount = 3;
-  init_info.ImageCount = 3;
+  init_info.MinImageCount = _swapchainMinImageCount;
+  init_info.ImageCount = (uint32_t)_swapchainImages.size();
   init_info.UseDynamicRendering = true;
 
   // dynamic rendering parameters for imgui to use
@@ -1025,20 +2312,37 @@ void VulkanEngine::impl::create_swapchain(uint32_t width, uint32_t height) {
 
   _swapchainImageFormat = VK_FORMAT_B8G8R8A8_UNORM;
 
+  // every surface supports FIFO, the other modes are optional
+  uint32_t modeCount = 0;
+  vkGetPhysicalDeviceSurfacePresentModesKHR(_chosenGPU, _surface, &modeCount,
+                                            nullptr);
+  std::vector<VkPresentModeKHR> supportedModes(modeCount);
+  vkGetPhysicalDeviceSurfacePresentModesKHR(_chosenGPU, _surface, &modeCount,
+                                            supportedModes.data());
+  _presentMode = _requestedPresentMode;
+  if (std::ranges::find(supportedModes, _presentMode) ==
+      supportedModes.end()) {
+    fmt::println("{} is not supported, falling back to FIFO",
+                 string_VkPresentModeKHR(_presentMode));
+    _presentMode = VK_PRESENT_MODE_FIFO_KHR;
+  }
+
   vkb::Swapchain vkbSwapchain =
       swapchainBuilder
           //.use_default_format_selection()
           .set_desired_format(VkSurfaceFormatKHR{
               .format = _swapchainImageFormat,
               .colorSpace = VK_COLOR_SPACE_SRGB_NONLINEAR_KHR})
-          // use vsync present mode
-          .set_desired_present_mode(VK_PRESENT_MODE_FIFO_KHR)
+          .set_desired_present_mode(_presentMode)
           .set_desired_extent(width, height)
           .add_image_usage_flags(VK_IMAGE_USAGE_TRANSFER_DST_BIT)
           .build()
           .value();
 
   _swapchainExtent = vkbSwapchain.extent;
+  // imgui needs at least two
+  _swapchainMinImageCount =
+      std::max(2u, vkbSwapchain.requested_min_image_count);
   // store swapchain and its related images
   _swapchain = vkbSwapchain.swapchain;
   _swapchainImages = vkbSwapchain.get_images().value();
@@ -1051,9 +2355,10 @@ void VulkanEngine::impl::create_swapchain(uint32_t width, uint32_t height) {
   }
 }
 
-AllocatedBuffer VulkanEngine::impl::create_buffer(size_t allocSize,
-                                                  VkBufferUsageFlags usage,
-                                                  VmaMemoryUsage memoryUsage) {
+AllocatedBuffer
+VulkanEngine::impl::create_buffer(size_t allocSize, VkBufferUsageFlags usage,
+                                  VmaMemoryUsage memoryUsage,
+                                  std::span<const uint32_t> queueFamilies) {
   // allocate buffer
   VkBufferCreateInfo bufferInfo = {.sType =
                                        VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO};
@@ -1062,6 +2367,13 @@ AllocatedBuffer VulkanEngine::impl::create_buffer(size_t allocSize,
 
   bufferInfo.usage = usage;
 
+  // buffers used by more than one queue family skip ownership transfers
+  if (queueFamilies.size() > 1) {
+    bufferInfo.sharingMode = VK_SHARING_MODE_CONCURRENT;
+    bufferInfo.queueFamilyIndexCount = (uint32_t)queueFamilies.size();
+    bufferInfo.pQueueFamilyIndices = queueFamilies.data();
+  }
+
   VmaAllocationCreateInfo vmaallocInfo = {};
   vmaallocInfo.usage = memoryUsage;
   vmaallocInfo.flags = VMA_ALLOCATION_CREATE_MAPPED_BIT;
@@ -1122,65 +2434,50 @@ void VulkanEngine::impl::immediate_submit(
 
 GPUMeshBuffers VulkanEngine::impl::uploadMesh(std::span<uint32_t> indices,
                                               std::span<Vertex> vertices) {
-  const size_t vertexBufferSize = vertices.size() * sizeof(Vertex);
-  const size_t indexBufferSize = indices.size() * sizeof(uint32_t);
+  MeshUploadInfo mesh{.indices = indices, .vertices = vertices};
+  return uploadMeshes({&mesh, 1}).front();
+}
 
-  GPUMeshBuffers newSurface;
+std::vector<GPUMeshBuffers>
+VulkanEngine::impl::uploadMeshes(std::span<const MeshUploadInfo> meshes) {
+  std::vector<GPUMeshBuffers> newSurfaces(meshes.size());
+
+  // every mesh gets its ranges in the geometry pool, the data is streamed
+  // through the staging ring and the copies go out in one submit
+  std::vector<std::byte> packed;
+  std::vector<std::byte> packedIndices;
+  for (size_t i = 0; i < meshes.size(); ++i) {
+    newSurfaces[i] = _geometryPool.allocate(
+        VERTEX_FORMAT, meshes[i].vertices.size(), meshes[i].indices.size());
+
+    // float vertices go up as is, the compact formats are encoded first
+    const void *vertexData = meshes[i].vertices.data();
+    if (VERTEX_FORMAT != VertexFormat::Float) {
+      pack_vertices(meshes[i].vertices, newSurfaces[i], packed);
+      vertexData = packed.data();
+    }
 
-  // create vertex buffer
-  newSurface.vertexBuffer = create_buffer(
-      vertexBufferSize,
-      VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT |
-          VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
-      VMA_MEMORY_USAGE_GPU_ONLY);
+    _uploadManager.upload(_geometryPool.vertexBuffer.buffer,
+                          newSurfaces[i].vertexOffset, vertexData,
+                          newSurfaces[i].vertexSize);
 
-  // find the adress of the vertex buffer
-  VkBufferDeviceAddressInfo deviceAdressInfo{
-      .sType = VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO,
-      .buffer = newSurface.vertexBuffer.buffer};
-  newSurface.vertexBufferAddress =
-      vkGetBufferDeviceAddress(_device, &deviceAdressInfo);
-
-  // create index buffer
-  newSurface.indexBuffer = create_buffer(indexBufferSize,
-                                         VK_BUFFER_USAGE_INDEX_BUFFER_BIT |
-                                             VK_BUFFER_USAGE_TRANSFER_DST_BIT,
-                                         VMA_MEMORY_USAGE_GPU_ONLY);
-
-  AllocatedBuffer staging = create_buffer(vertexBufferSize + indexBufferSize,
-                                          VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-                                          VMA_MEMORY_USAGE_CPU_ONLY);
-
-  void *data;
-  VK_CHECK(vmaMapMemory(_allocator, staging.allocation, &data));
-
-  // copy vertex buffer
-  memcpy(data, vertices.data(), vertexBufferSize);
-  // copy index buffer
-  memcpy((char *)data + vertexBufferSize, indices.data(), indexBufferSize);
-
-  immediate_submit([&](VkCommandBuffer cmd) {
-    VkBufferCopy vertexCopy{0};
-    vertexCopy.dstOffset = 0;
-    vertexCopy.srcOffset = 0;
-    vertexCopy.size = vertexBufferSize;
-
-    vkCmdCopyBuffer(cmd, staging.buffer, newSurface.vertexBuffer.buffer, 1,
-                    &vertexCopy);
-
-    VkBufferCopy indexCopy{0};
-    indexCopy.dstOffset = 0;
-    indexCopy.srcOffset = vertexBufferSize;
-    indexCopy.size = indexBufferSize;
-
-    vkCmdCopyBuffer(cmd, staging.buffer, newSurface.indexBuffer.buffer, 1,
-                    &indexCopy);
-  });
+    const void *indexData = meshes[i].indices.data();
+    if (newSurfaces[i].indexType != VK_INDEX_TYPE_UINT32) {
+      pack_indices(meshes[i].indices, newSurfaces[i].indexType,
+                   packedIndices);
+      indexData = packedIndices.data();
+    }
+
+    _uploadManager.upload(_geometryPool.indexBuffer.buffer,
+                          newSurfaces[i].indexOffset, indexData,
+                          newSurfaces[i].indexSize);
+  }
 
-  vmaUnmapMemory(_allocator, staging.allocation);
-  destroy_buffer(staging);
+  // the graphics queue waits on the upload timeline before drawing, so there
+  // is no need to block here
+  _uploadManager.flush();
 
-  return newSurface;
+  return newSurfaces;
 }
 
 void VulkanEngine::impl::draw_background(VkCommandBuffer cmd) {
@@ -1203,10 +2500,334 @@ void VulkanEngine::impl::draw_background(VkCommandBuffer cmd) {
                 std::ceil(_drawExtent.height / 16.0), 1);
 }
 
+void VulkanEngine::impl::submit_background() {
+  CPU_ZONE("submit background");
+  VkCommandBuffer cmd = get_current_frame()._computeCommandBuffer;
+
+  // the frame's timeline wait covers the compute work of its last use as
+  // well, since the graphics submit waited for it
+  VK_CHECK(vkResetCommandBuffer(cmd, 0));
+  VkCommandBufferBeginInfo cmdBeginInfo = vkinit::command_buffer_begin_info(
+      VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT);
+  VK_CHECK(vkBeginCommandBuffer(cmd, &cmdBeginInfo));
+
+  // graphics finished with this image before the frame's wait returned and
+  // its contents are overwritten, so it is taken without an ownership transfer.
+  // nothing earlier on this queue touched it, the barrier only has to order
+  // the layout change before the shader writes
+  vkutil::acquire_image(cmd, _drawImage.image, VK_QUEUE_FAMILY_IGNORED,
+                        VK_QUEUE_FAMILY_IGNORED, VK_IMAGE_LAYOUT_UNDEFINED,
+                        VK_IMAGE_LAYOUT_GENERAL,
+                        VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+                        VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT);
+  auto scope = _gpuProfiler.begin_scope(cmd, "background (compute queue)");
+  draw_background(cmd);
+  _gpuProfiler.end_scope(cmd, scope);
+  vkutil::release_image(cmd, _drawImage.image, _computeQueueFamily,
+                        _graphicsQueueFamily, VK_IMAGE_LAYOUT_GENERAL,
+                        VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+                        VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+                        VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT);
+
+  VK_CHECK(vkEndCommandBuffer(cmd));
+
+  VkCommandBufferSubmitInfo cmdinfo = vkinit::command_buffer_submit_info(cmd);
+  VkSemaphoreSubmitInfo signalInfo = vkinit::semaphore_submit_info(
+      VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT, _computeTimeline);
+  signalInfo.value = ++_computeTimelineValue;
+
+  VkSubmitInfo2 submit = vkinit::submit_info(&cmdinfo, {&signalInfo, 1}, {});
+  VK_CHECK(vkQueueSubmit2(_computeQueue, 1, &submit, VK_NULL_HANDLE));
+}
+
+void VulkanEngine::impl::update_camera() {
+  const glm::mat4 &view = _view;
+  // camera projection
+  glm::mat4 projection = glm::perspective(
+      glm::radians(70.f), (float)_drawExtent.width / (float)_drawExtent.height,
+      10000.f, 0.1f);
+  // 0.1f, 10000.f);
+
+  // invert the Y direction on projection matrix so that we are more similar
+  // to opengl and gltf axis
+  projection[1][1] *= -1;
+
+  _viewProj = projection * view;
+}
+
+void VulkanEngine::impl::build_render_graph(uint32_t swapchainImageIndex) {
+  RenderGraph &graph = _renderGraph;
+  graph.reset();
+
+  // with async compute the background was drawn on the compute queue and
+  // the acquire at the start of the frame left the image ready to draw into
+  bool asyncBackground = _asyncComputeAvailable && _asyncBackground;
+  std::optional<RenderGraph::ResourceState> drawImageEntry;
+  if (asyncBackground) {
+    drawImageEntry = RenderGraph::ResourceState{
+        .layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL};
+  }
+  auto drawImage =
+      graph.import_image("draw image", _drawImage.image,
+                         VK_IMAGE_ASPECT_COLOR_BIT, drawImageEntry);
+  // depth only lives within the frame, so the graph owns it
+  VkImageCreateInfo depthInfo = vkinit::image_create_info(
+      _depthImage.imageFormat,
+      VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+      _depthImage.imageExtent);
+  auto depthImage =
+      graph.create_image("depth image", depthInfo, VK_IMAGE_ASPECT_DEPTH_BIT);
+
+  VkImageCreateInfo pyramidInfo = vkinit::image_create_info(
+      _depthPyramid.imageFormat,
+      VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+      _depthPyramid.imageExtent);
+  pyramidInfo.mipLevels = _depthPyramidLevels;
+  auto depthPyramid = graph.create_image("depth pyramid", pyramidInfo,
+                                         VK_IMAGE_ASPECT_COLOR_BIT);
+  // the submit waits for the acquire at color output, chain onto that
+  RenderGraph::ResourceId swapchainImage{};
+  if (!_headless) {
+    swapchainImage = graph.import_image(
+        "swapchain image", _swapchainImages[swapchainImageIndex],
+        VK_IMAGE_ASPECT_COLOR_BIT,
+        RenderGraph::ResourceState{
+            .writeStages = VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT});
+  }
+  auto drawCommands =
+      graph.import_buffer("draw commands", _drawCommandBuffer.buffer);
+  auto drawCounts = graph.import_buffer("draw counts", _drawCountBuffer.buffer);
+  auto visibility = graph.import_buffer("visibility", _visibilityBuffer.buffer);
+  auto cullStats = graph.import_buffer(
+      "cull stats", get_current_frame()._cullStatsBuffer.buffer);
+
+  // headless, the draw image is the result
+  if (_headless) {
+    graph.export_resource(drawImage);
+  } else {
+    graph.export_resource(
+        swapchainImage,
+        ResourceUsage{VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT,
+                      VK_ACCESS_2_NONE, VK_IMAGE_LAYOUT_PRESENT_SRC_KHR});
+  }
+  // read by the next frame's culling and by the cpu once the frame is done
+  graph.export_resource(visibility);
+  graph.export_resource(cullStats, rgusage::HostRead);
+
+  if (!asyncBackground) {
+    graph
+        .add_pass("background",
+                  [this](VkCommandBuffer cmd) { draw_background(cmd); })
+        .overwrite(drawImage, rgusage::ComputeStorageImageWrite);
+  }
+
+  bool gpuCulling = _cullingMode == CullingMode::Gpu;
+  // occlusion culling needs the depth of the gpu path
+  bool occlusion = _occlusionCulling && gpuCulling;
+
+  auto add_cull_passes = [&](bool latePass) {
+    graph
+        .add_pass("clear draw counts",
+                  [this](VkCommandBuffer cmd) {
+                    vkCmdFillBuffer(cmd, _drawCountBuffer.buffer, 0,
+                                    VK_WHOLE_SIZE, 0);
+                  })
+        .overwrite(drawCounts, rgusage::Clear);
+
+    auto cull = graph.add_pass(latePass ? "late cull" : "cull",
+                               [this, latePass](VkCommandBuffer cmd) {
+                                 cull_scene(cmd, latePass);
+                               });
+    // the cull set binds the pyramid in both passes. the early one never
+    // samples it, declaring it still has the graph move it to GENERAL
+    cull.overwrite(drawCommands, rgusage::ComputeStorageWrite)
+        .write(drawCounts, rgusage::ComputeStorageReadWrite)
+        .read(depthPyramid, rgusage::ComputeSampledGeneral);
+    if (latePass) {
+      cull.write(visibility, rgusage::ComputeStorageReadWrite);
+    } else {
+      cull.read(visibility, rgusage::ComputeStorageRead);
+    }
+
+    graph
+        .add_pass("cull stats",
+                  [this](VkCommandBuffer cmd) { copy_cull_stats(cmd); })
+        .read(drawCounts, rgusage::TransferRead)
+        .write(cullStats, rgusage::TransferWrite);
+  };
+
+  if (gpuCulling) {
+    add_cull_passes(false);
+  }
+
+  auto geometry = graph.add_pass(
+      "geometry", [this](VkCommandBuffer cmd) { draw_geometry(cmd); });
+  geometry.write(drawImage, rgusage::ColorAttachment)
+      .overwrite(depthImage, rgusage::DepthAttachment);
+  if (gpuCulling) {
+    geometry.read(drawCommands, rgusage::IndirectRead)
+        .read(drawCounts, rgusage::IndirectRead);
+  }
+
+  if (occlusion) {
+    graph
+        .add_pass("depth pyramid",
+                  [this](VkCommandBuffer cmd) { build_depth_pyramid(cmd); })
+        .read(depthImage, rgusage::ComputeSampledDepth)
+        .overwrite(depthPyramid, rgusage::ComputeStorageImageWrite);
+
+    add_cull_passes(true);
+
+    graph
+        .add_pass("late geometry",
+                  [this](VkCommandBuffer cmd) { draw_geometry_late(cmd); })
+        .write(drawImage, rgusage::ColorAttachment)
+        .write(depthImage, rgusage::DepthAttachment)
+        .read(drawCommands, rgusage::IndirectRead)
+        .read(drawCounts, rgusage::IndirectRead);
+  }
+
+  // the finished frame, read back by the cpu once the frame is done
+  if (VkBuffer readback = _frameCapture.capture_frame()) {
+    auto captureBuffer = graph.import_buffer("capture readback", readback);
+    graph.export_resource(captureBuffer, rgusage::HostRead);
+    graph
+        .add_pass("capture",
+                  [this](VkCommandBuffer cmd) {
+                    _frameCapture.record_copy(cmd, _drawImage.image);
+                  })
+        .read(drawImage, rgusage::TransferRead)
+        .overwrite(captureBuffer, rgusage::TransferWrite);
+  }
+
+  // copy the draw image into the swapchain, then draw imgui over it
+  if (!_headless) {
+    graph
+        .add_pass("blit",
+                  [this, swapchainImageIndex](VkCommandBuffer cmd) {
+                    vkutil::copy_image_to_image(
+                        cmd, _drawImage.image,
+                        _swapchainImages[swapchainImageIndex], _drawExtent,
+                        _swapchainExtent);
+                  })
+        .read(drawImage, rgusage::TransferRead)
+        .overwrite(swapchainImage, rgusage::TransferWrite);
+
+    graph
+        .add_pass("imgui",
+                  [this, swapchainImageIndex](VkCommandBuffer cmd) {
+                    draw_imgui(cmd,
+                               _swapchainImageViews[swapchainImageIndex]);
+                  })
+        .write(swapchainImage, rgusage::ColorAttachment);
+  }
+
+  // a different set of live passes can move the transients around
+  if (graph.compile()) {
+    _depthImage.image = graph.resources[depthImage].image;
+    _depthPyramid.image = graph.resources[depthPyramid].image;
+    create_transient_views();
+  }
+}
+
+void VulkanEngine::impl::cull_scene(VkCommandBuffer cmd, bool latePass) {
+  GPUCullPushConstants pc{};
+  pc.viewProj = _viewProj;
+  pc.objectCount = (uint32_t)_sceneObjects.size();
+  pc.bucketCapacity = (uint32_t)_sceneObjects.size();
+  pc.flags = (_frustumCulling ? CULL_FRUSTUM : 0) |
+             (_occlusionCulling ? CULL_OCCLUSION : 0) |
+             (latePass ? CULL_LATE_PASS : 0);
+  pc.pyramidSize = {_depthPyramidExtent.width, _depthPyramidExtent.height};
+
+  vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, _cullPipeline);
+  vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE,
+                          _cullPipelineLayout, 0, 1, &_cullDescriptors, 0,
+                          nullptr);
+  vkCmdPushConstants(cmd, _cullPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0,
+                     sizeof(GPUCullPushConstants), &pc);
+  // 64 objects per workgroup
+  vkCmdDispatch(cmd, (pc.objectCount + 63) / 64, 1, 1);
+}
+
+void VulkanEngine::impl::copy_cull_stats(VkCommandBuffer cmd) {
+  // keep the counts for the statistics, read when the frame has finished
+  FrameData &frame = get_current_frame();
+  VkBufferCopy countCopy{
+      .dstOffset =
+          frame._cullStatsPasses * DRAW_BUCKET_COUNT * sizeof(uint32_t),
+      .size = DRAW_BUCKET_COUNT * sizeof(uint32_t)};
+  vkCmdCopyBuffer(cmd, _drawCountBuffer.buffer, frame._cullStatsBuffer.buffer,
+                  1, &countCopy);
+  frame._cullStatsPasses++;
+}
+
+void VulkanEngine::impl::build_depth_pyramid(VkCommandBuffer cmd) {
+  vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, _depthReducePipeline);
+
+  for (uint32_t level = 0; level < _depthPyramidLevels; ++level) {
+    glm::vec2 levelSize{std::max(1u, _depthPyramidExtent.width >> level),
+                        std::max(1u, _depthPyramidExtent.height >> level)};
+
+    vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE,
+                            _depthReducePipelineLayout, 0, 1,
+                            &_depthReduceDescriptors[level], 0, nullptr);
+    vkCmdPushConstants(cmd, _depthReducePipelineLayout,
+                       VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(glm::vec2),
+                       &levelSize);
+    vkCmdDispatch(cmd, ((uint32_t)levelSize.x + 31) / 32,
+                  ((uint32_t)levelSize.y + 31) / 32, 1);
+
+    // the next level reads this one
+    vkutil::memory_barrier(cmd, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+                           VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT,
+                           VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+                           VK_ACCESS_2_SHADER_SAMPLED_READ_BIT);
+  }
+}
+
+void VulkanEngine::impl::cull_scene_cpu() {
+  CPU_ZONE("cpu culling");
+  Frustum frustum = make_frustum(_viewProj);
+  if (_frustumCulling) {
+    _cullingStats =
+        cull_frustum(frustum, _cullingBounds, _visibleObjects, _jobs);
+  } else {
+    _visibleObjects.resize(_sceneObjects.size());
+    std::iota(_visibleObjects.begin(), _visibleObjects.end(), 0);
+    _cullingStats = {.tested = (uint32_t)_sceneObjects.size(),
+                     .visible = (uint32_t)_sceneObjects.size()};
+  }
+
+  // same command layout the culling pass writes, the wait for the frame
+  // made sure the gpu is done with this frame's buffer
+  FrameData &frame = get_current_frame();
+  auto *commands = (VkDrawIndexedIndirectCommand *)
+                       frame._indirectBuffer.info.pMappedData;
+  frame._indirectDrawCounts[0] = frame._indirectDrawCounts[1] = 0;
+  for (uint32_t id : _visibleObjects) {
+    const GPUObjectData &object = _sceneObjects[id];
+    uint32_t slot = object.drawBucket * (uint32_t)_sceneObjects.size() +
+                    frame._indirectDrawCounts[object.drawBucket]++;
+    commands[slot] = {.indexCount = object.indexCount,
+                      .instanceCount = 1,
+                      .firstIndex = object.firstIndex,
+                      .vertexOffset = 0,
+                      .firstInstance = id};
+  }
+  vmaFlushAllocation(_allocator, frame._indirectBuffer.allocation, 0,
+                     VK_WHOLE_SIZE);
+}
+
 void VulkanEngine::impl::draw_geometry(VkCommandBuffer cmd) {
+  if (_cullingMode == CullingMode::Cpu && _recordDirectDraws) {
+    draw_geometry_secondary(cmd);
+    return;
+  }
+
   // begin a render pass  connected to our draw image
   VkRenderingAttachmentInfo colorAttachment = vkinit::attachment_info(
-      _drawImage.imageView, nullptr, VK_IMAGE_LAYOUT_GENERAL);
+      _drawImage.imageView, nullptr, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
   VkRenderingAttachmentInfo depthAttachment = vkinit::depth_attachment_info(
       _depthImage.imageView, VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL);
 
@@ -1217,6 +2838,176 @@ void VulkanEngine::impl::draw_geometry(VkCommandBuffer cmd) {
 
   vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, _trianglePipeline);
 
+  set_draw_viewport(cmd);
+
+  // launch a draw command to draw 3 vertices
+  // launch a draw command to draw 3 vertices
+  vkCmdDraw(cmd, 3, 1, 0, 0);
+
+  vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, _meshPipeline);
+
+  GPUDrawPushConstants push_constants;
+  push_constants.worldMatrix = dequantize_matrix(rectangle);
+  push_constants.vertexBuffer = rectangle.vertexBufferAddress;
+
+  vkCmdPushConstants(cmd, _meshPipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0,
+                     sizeof(GPUDrawPushConstants), &push_constants);
+  // every mesh lives in the geometry pool, only the index type varies
+  vkCmdBindIndexBuffer(cmd, _geometryPool.indexBuffer.buffer, 0,
+                       rectangle.indexType);
+  vkCmdDrawIndexed(cmd, 6, 1, rectangle.firstIndex, 0, 0);
+
+  draw_scene(cmd);
+
+  vkCmdEndRendering(cmd);
+}
+
+void VulkanEngine::impl::draw_geometry_secondary(VkCommandBuffer cmd) {
+  auto start = std::chrono::steady_clock::now();
+
+  VkRenderingAttachmentInfo colorAttachment = vkinit::attachment_info(
+      _drawImage.imageView, nullptr, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
+  VkRenderingAttachmentInfo depthAttachment = vkinit::depth_attachment_info(
+      _depthImage.imageView, VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL);
+
+  VkRenderingInfo renderInfo =
+      vkinit::rendering_info(_windowExtent, &colorAttachment, &depthAttachment);
+  // everything inside comes from the secondary command buffers
+  renderInfo.flags = VK_RENDERING_CONTENTS_SECONDARY_COMMAND_BUFFERS_BIT;
+
+  vkCmdBeginRendering(cmd, &renderInfo);
+
+  FrameData &frame = get_current_frame();
+  size_t threads = std::clamp<size_t>(_recordThreads, 1, _maxRecordThreads);
+  size_t perThread = (_visibleObjects.size() + threads - 1) / threads;
+
+  // one job per chunk, each recording with the pool of its chunk index so
+  // no pool is used by two threads at once
+  JobHandle recording =
+      _jobs.parallel_for(threads, 1, [&](size_t firstChunk, size_t lastChunk) {
+        CPU_ZONE("record draws");
+        for (size_t t = firstChunk; t < lastChunk; ++t) {
+          size_t first = std::min(t * perThread, _visibleObjects.size());
+          size_t count = std::min(perThread, _visibleObjects.size() - first);
+          std::span<const uint32_t> objects{_visibleObjects.data() + first,
+                                            count};
+
+          vkResetCommandPool(_device, frame._recordPools[t], 0);
+          record_direct_draws(frame._recordCommandBuffers[t], objects);
+        }
+      });
+
+  // meanwhile the main thread records the tutorial geometry
+  VkCommandBuffer mainSecondary = frame._recordCommandBuffers.back();
+  vkResetCommandPool(_device, frame._recordPools.back(), 0);
+  begin_secondary(mainSecondary);
+
+  vkCmdBindPipeline(mainSecondary, VK_PIPELINE_BIND_POINT_GRAPHICS,
+                    _trianglePipeline);
+  vkCmdDraw(mainSecondary, 3, 1, 0, 0);
+
+  vkCmdBindPipeline(mainSecondary, VK_PIPELINE_BIND_POINT_GRAPHICS,
+                    _meshPipeline);
+  GPUDrawPushConstants push_constants;
+  push_constants.worldMatrix = dequantize_matrix(rectangle);
+  push_constants.vertexBuffer = rectangle.vertexBufferAddress;
+  vkCmdPushConstants(mainSecondary, _meshPipelineLayout,
+                     VK_SHADER_STAGE_VERTEX_BIT, 0,
+                     sizeof(GPUDrawPushConstants), &push_constants);
+  vkCmdBindIndexBuffer(mainSecondary, _geometryPool.indexBuffer.buffer, 0,
+                       rectangle.indexType);
+  vkCmdDrawIndexed(mainSecondary, 6, 1, rectangle.firstIndex, 0, 0);
+  VK_CHECK(vkEndCommandBuffer(mainSecondary));
+
+  _jobs.wait(recording);
+
+  // the tutorial geometry first, then the scene in thread order
+  std::vector<VkCommandBuffer> secondaries{mainSecondary};
+  secondaries.insert(secondaries.end(), frame._recordCommandBuffers.begin(),
+                     frame._recordCommandBuffers.begin() + threads);
+  vkCmdExecuteCommands(cmd, (uint32_t)secondaries.size(), secondaries.data());
+
+  vkCmdEndRendering(cmd);
+
+  auto end = std::chrono::steady_clock::now();
+  _recordMilliseconds =
+      std::chrono::duration<double, std::milli>(end - start).count();
+}
+
+void VulkanEngine::impl::begin_secondary(VkCommandBuffer secondary) {
+  // secondaries executed inside dynamic rendering inherit its formats
+  VkCommandBufferInheritanceRenderingInfo renderingInfo{
+      .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_RENDERING_INFO};
+  renderingInfo.colorAttachmentCount = 1;
+  renderingInfo.pColorAttachmentFormats = &_drawImage.imageFormat;
+  renderingInfo.depthAttachmentFormat = _depthImage.imageFormat;
+  renderingInfo.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+
+  VkCommandBufferInheritanceInfo inheritanceInfo{
+      .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO};
+  inheritanceInfo.pNext = &renderingInfo;
+
+  VkCommandBufferBeginInfo beginInfo = vkinit::command_buffer_begin_info(
+      VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT |
+      VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT);
+  beginInfo.pInheritanceInfo = &inheritanceInfo;
+
+  VK_CHECK(vkBeginCommandBuffer(secondary, &beginInfo));
+
+  // dynamic state is not inherited from the primary
+  set_draw_viewport(secondary);
+}
+
+void VulkanEngine::impl::record_direct_draws(
+    VkCommandBuffer secondary, std::span<const uint32_t> objects) {
+  begin_secondary(secondary);
+
+  vkCmdBindPipeline(secondary, VK_PIPELINE_BIND_POINT_GRAPHICS, _meshPipeline);
+
+  VkIndexType boundIndexType = VK_INDEX_TYPE_MAX_ENUM;
+  for (uint32_t id : objects) {
+    const GPUObjectData &object = _sceneObjects[id];
+
+    VkIndexType indexType =
+        object.drawBucket == draw_bucket(VK_INDEX_TYPE_UINT16)
+            ? VK_INDEX_TYPE_UINT16
+            : VK_INDEX_TYPE_UINT32;
+    if (indexType != boundIndexType) {
+      vkCmdBindIndexBuffer(secondary, _geometryPool.indexBuffer.buffer, 0,
+                           indexType);
+      boundIndexType = indexType;
+    }
+
+    GPUDrawPushConstants push_constants;
+    push_constants.worldMatrix = _viewProj * object.renderMatrix;
+    push_constants.vertexBuffer = object.vertexBuffer;
+    vkCmdPushConstants(secondary, _meshPipelineLayout,
+                       VK_SHADER_STAGE_VERTEX_BIT, 0,
+                       sizeof(GPUDrawPushConstants), &push_constants);
+    vkCmdDrawIndexed(secondary, object.indexCount, 1, object.firstIndex, 0, 0);
+  }
+
+  VK_CHECK(vkEndCommandBuffer(secondary));
+}
+
+void VulkanEngine::impl::draw_geometry_late(VkCommandBuffer cmd) {
+  // continue on top of the early pass
+  VkRenderingAttachmentInfo colorAttachment = vkinit::attachment_info(
+      _drawImage.imageView, nullptr, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
+  VkRenderingAttachmentInfo depthAttachment = vkinit::depth_attachment_info(
+      _depthImage.imageView, VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL);
+  depthAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_LOAD;
+
+  VkRenderingInfo renderInfo =
+      vkinit::rendering_info(_windowExtent, &colorAttachment, &depthAttachment);
+
+  vkCmdBeginRendering(cmd, &renderInfo);
+  set_draw_viewport(cmd);
+  draw_scene(cmd);
+  vkCmdEndRendering(cmd);
+}
+
+void VulkanEngine::impl::set_draw_viewport(VkCommandBuffer cmd) {
   // set dynamic viewport and scissor
   VkViewport viewport = {};
   viewport.x = 0;
@@ -1235,49 +3026,43 @@ void VulkanEngine::impl::draw_geometry(VkCommandBuffer cmd) {
   scissor.extent.height = _drawExtent.height;
 
   vkCmdSetScissor(cmd, 0, 1, &scissor);
+}
 
-  // launch a draw command to draw 3 vertices
-  // launch a draw command to draw 3 vertices
-  vkCmdDraw(cmd, 3, 1, 0, 0);
-
-  vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, _meshPipeline);
-
-  GPUDrawPushConstants push_constants;
-  push_constants.worldMatrix = glm::identity<glm::mat4>();
-  push_constants.vertexBuffer = rectangle.vertexBufferAddress;
-
-  vkCmdPushConstants(cmd, _meshPipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0,
-                     sizeof(GPUDrawPushConstants), &push_constants);
-  vkCmdBindIndexBuffer(cmd, rectangle.indexBuffer.buffer, 0,
-                       VK_INDEX_TYPE_UINT32);
-  vkCmdDrawIndexed(cmd, 6, 1, 0, 0, 0);
-
-  glm::mat4 view = glm::translate(
-      // (glm::vec3{0, 0, std::lerp(2, -2, _frameNumber / (500.0))}));
-      glm::vec3{0, 0, -5});
-  // camera projection
-  glm::mat4 projection = glm::perspective(
-      glm::radians(70.f), (float)_drawExtent.width / (float)_drawExtent.height,
-      10000.f, 0.1f);
-  // 0.1f, 10000.f);
-
-  // invert the Y direction on projection matrix so that we are more similar
-  // to opengl and gltf axis
-  projection[1][1] *= -1;
-
-  push_constants.worldMatrix = projection * view;
-  // projection * view *
-  // glm::rotate(_frameNumber / (2 * 10 * glm::pi<float>()),
-  //             glm::vec3{0, 1, 0});
-  push_constants.vertexBuffer = testMeshes[2]->meshBuffers.vertexBufferAddress;
+void VulkanEngine::impl::draw_scene(VkCommandBuffer cmd) {
+  // the scene is drawn from the commands the culling pass wrote, one indirect
+  // draw per index type
+  vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, _indirectPipeline);
+
+  GPUSceneDrawPushConstants scene_constants;
+  scene_constants.viewProj = _viewProj;
+  scene_constants.objectBuffer = _objectBufferAddress;
+  vkCmdPushConstants(cmd, _indirectPipelineLayout, VK_SHADER_STAGE_VERTEX_BIT,
+                     0, sizeof(GPUSceneDrawPushConstants), &scene_constants);
+
+  const uint32_t maxDraws = (uint32_t)_sceneObjects.size();
+  FrameData &frame = get_current_frame();
+  for (VkIndexType type : {VK_INDEX_TYPE_UINT16, VK_INDEX_TYPE_UINT32}) {
+    uint32_t bucket = draw_bucket(type);
+    vkCmdBindIndexBuffer(cmd, _geometryPool.indexBuffer.buffer, 0, type);
+
+    // the cpu path already knows how many draws each bucket has
+    if (_cullingMode == CullingMode::Cpu) {
+      if (frame._indirectDrawCounts[bucket] > 0) {
+        vkCmdDrawIndexedIndirect(
+            cmd, frame._indirectBuffer.buffer,
+            bucket * maxDraws * sizeof(VkDrawIndexedIndirectCommand),
+            frame._indirectDrawCounts[bucket],
+            sizeof(VkDrawIndexedIndirectCommand));
+      }
+      continue;
+    }
 
-  vkCmdPushConstants(cmd, _meshPipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0,
-                     sizeof(GPUDrawPushConstants), &push_constants);
-  vkCmdBindIndexBuffer(cmd, testMeshes[2]->meshBuffers.indexBuffer.buffer, 0,
-                       VK_INDEX_TYPE_UINT32);
-  vkCmdDrawIndexed(cmd, testMeshes[2]->surfaces[0].count, 1,
-                   testMeshes[2]->surfaces[0].startIndex, 0, 0);
-  vkCmdEndRendering(cmd);
+    vkCmdDrawIndexedIndirectCount(
+        cmd, _drawCommandBuffer.buffer,
+        bucket * maxDraws * sizeof(VkDrawIndexedIndirectCommand),
+        _drawCountBuffer.buffer, bucket * sizeof(uint32_t), maxDraws,
+        sizeof(VkDrawIndexedIndirectCommand));
+  }
 }
 
 void VulkanEngine::impl::draw_imgui(VkCommandBuffer cmd,
@@ -0,0 +1,287 @@
+#include "vk_geometry.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include <glm/common.hpp>
+#include <glm/packing.hpp>
+
+void RangeAllocator::init(VkDeviceSize size) {
+  capacity = size;
+  used = 0;
+  freeBlocks.clear();
+  freeBlocks.push_back({.offset = 0, .size = size});
+}
+
+bool RangeAllocator::allocate(VkDeviceSize size, VkDeviceSize alignment,
+                              VkDeviceSize *outOffset) {
+  if (size == 0) {
+    *outOffset = 0;
+    return true;
+  }
+
+  for (size_t i = 0; i < freeBlocks.size(); ++i) {
+    Block block = freeBlocks[i];
+
+    VkDeviceSize offset =
+        (block.offset + alignment - 1) / alignment * alignment;
+    VkDeviceSize padding = offset - block.offset;
+    if (padding + size > block.size) {
+      continue;
+    }
+
+    // whatever is left on either side of the range stays free
+    Block before{.offset = block.offset, .size = padding};
+    Block after{.offset = offset + size,
+                .size = block.size - padding - size};
+
+    freeBlocks.erase(freeBlocks.begin() + i);
+    if (after.size > 0) {
+      freeBlocks.insert(freeBlocks.begin() + i, after);
+    }
+    if (before.size > 0) {
+      freeBlocks.insert(freeBlocks.begin() + i, before);
+    }
+
+    used += size;
+    *outOffset = offset;
+    return true;
+  }
+  return false;
+}
+
+void RangeAllocator::free(VkDeviceSize offset, VkDeviceSize size) {
+  if (size == 0) {
+    return;
+  }
+  used -= size;
+
+  auto it = std::lower_bound(
+      freeBlocks.begin(), freeBlocks.end(), offset,
+      [](const Block &block, VkDeviceSize o) { return block.offset < o; });
+  it = freeBlocks.insert(it, {.offset = offset, .size = size});
+
+  // merge with the following block
+  auto next = it + 1;
+  if (next != freeBlocks.end() && it->offset + it->size == next->offset) {
+    it->size += next->size;
+    freeBlocks.erase(next);
+  }
+
+  // merge with the preceding block
+  if (it != freeBlocks.begin()) {
+    auto prev = it - 1;
+    if (prev->offset + prev->size == it->offset) {
+      prev->size += it->size;
+      freeBlocks.erase(it);
+    }
+  }
+}
+
+void GeometryPool::init(VkDevice device, VmaAllocator allocator,
+                        VkDeviceSize vertexCapacity,
+                        VkDeviceSize indexCapacity,
+                        std::span<const uint32_t> queueFamilies) {
+  VkSharingMode sharingMode = queueFamilies.size() > 1
+                                  ? VK_SHARING_MODE_CONCURRENT
+                                  : VK_SHARING_MODE_EXCLUSIVE;
+
+  VmaAllocationCreateInfo vmaallocInfo = {};
+  vmaallocInfo.usage = VMA_MEMORY_USAGE_GPU_ONLY;
+
+  // create vertex buffer
+  VkBufferCreateInfo vertexInfo = {.sType =
+                                       VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO};
+  vertexInfo.size = vertexCapacity;
+  vertexInfo.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+                     VK_BUFFER_USAGE_TRANSFER_DST_BIT |
+                     VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT;
+  vertexInfo.sharingMode = sharingMode;
+  vertexInfo.queueFamilyIndexCount = (uint32_t)queueFamilies.size();
+  vertexInfo.pQueueFamilyIndices = queueFamilies.data();
+
+  VK_CHECK(vmaCreateBuffer(allocator, &vertexInfo, &vmaallocInfo,
+                           &vertexBuffer.buffer, &vertexBuffer.allocation,
+                           &vertexBuffer.info));
+
+  // find the adress of the vertex buffer
+  VkBufferDeviceAddressInfo deviceAdressInfo{
+      .sType = VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO,
+      .buffer = vertexBuffer.buffer};
+  vertexBufferAddress = vkGetBufferDeviceAddress(device, &deviceAdressInfo);
+
+  // create index buffer
+  VkBufferCreateInfo indexInfo = {.sType =
+                                      VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO};
+  indexInfo.size = indexCapacity;
+  indexInfo.usage =
+      VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+  indexInfo.sharingMode = sharingMode;
+  indexInfo.queueFamilyIndexCount = (uint32_t)queueFamilies.size();
+  indexInfo.pQueueFamilyIndices = queueFamilies.data();
+
+  VK_CHECK(vmaCreateBuffer(allocator, &indexInfo, &vmaallocInfo,
+                           &indexBuffer.buffer, &indexBuffer.allocation,
+                           &indexBuffer.info));
+
+  vertexRanges.init(vertexCapacity);
+  indexRanges.init(indexCapacity);
+}
+
+void GeometryPool::destroy(VmaAllocator allocator) {
+  vmaDestroyBuffer(allocator, vertexBuffer.buffer, vertexBuffer.allocation);
+  vmaDestroyBuffer(allocator, indexBuffer.buffer, indexBuffer.allocation);
+}
+
+GPUMeshBuffers GeometryPool::allocate(VertexFormat format, size_t vertexCount,
+                                      size_t indexCount) {
+  GPUMeshBuffers mesh{};
+  mesh.vertexFormat = format;
+  mesh.positionScale = glm::vec3{1.f};
+  mesh.positionOffset = glm::vec3{0.f};
+  mesh.vertexSize = vertexCount * vertex_stride(format);
+  mesh.indexType = vertexCount <= 65536 ? VK_INDEX_TYPE_UINT16
+                                        : VK_INDEX_TYPE_UINT32;
+  VkDeviceSize indexStride = index_stride(mesh.indexType);
+  mesh.indexSize = indexCount * indexStride;
+  mesh.indexCount = (uint32_t)indexCount;
+
+  // vertices are read through buffer references, keep them 16 byte aligned
+  if (!vertexRanges.allocate(mesh.vertexSize, 16, &mesh.vertexOffset) ||
+      !indexRanges.allocate(mesh.indexSize, indexStride, &mesh.indexOffset)) {
+    fmt::println("Geometry pool exhausted: {} of {} vertex bytes, {} of {} "
+                 "index bytes in use",
+                 vertexRanges.used, vertexRanges.capacity, indexRanges.used,
+                 indexRanges.capacity);
+    abort();
+  }
+
+  mesh.firstIndex = (uint32_t)(mesh.indexOffset / indexStride);
+  mesh.vertexBufferAddress = vertexBufferAddress + mesh.vertexOffset;
+  return mesh;
+}
+
+void GeometryPool::free(const GPUMeshBuffers &mesh) {
+  vertexRanges.free(mesh.vertexOffset, mesh.vertexSize);
+  indexRanges.free(mesh.indexOffset, mesh.indexSize);
+}
+
+namespace {
+// octahedral mapping of a unit vector onto [-1, 1]^2
+glm::vec2 oct_encode(glm::vec3 n) {
+  n /= std::abs(n.x) + std::abs(n.y) + std::abs(n.z);
+  glm::vec2 p{n.x, n.y};
+  if (n.z < 0.f) {
+    glm::vec2 sign{p.x >= 0.f ? 1.f : -1.f, p.y >= 0.f ? 1.f : -1.f};
+    p = (1.f - glm::abs(glm::vec2{p.y, p.x})) * sign;
+  }
+  return p;
+}
+
+uint32_t pack_normal(glm::vec3 n) {
+  // degenerate normals would divide by zero, point them somewhere
+  if (n.x == 0.f && n.y == 0.f && n.z == 0.f) {
+    n = {0.f, 0.f, 1.f};
+  }
+  return glm::packSnorm2x16(oct_encode(n));
+}
+
+template <typename T> void pack_attributes(const Vertex &v, T &out) {
+  out.normal = pack_normal(v.normal);
+  out.uv = glm::packHalf2x16({v.uv_x, v.uv_y});
+  out.color = glm::packUnorm4x8(v.color);
+}
+} // namespace
+
+size_t index_stride(VkIndexType type) {
+  return type == VK_INDEX_TYPE_UINT16 ? sizeof(uint16_t) : sizeof(uint32_t);
+}
+
+void pack_indices(std::span<const uint32_t> indices, VkIndexType type,
+                  std::vector<std::byte> &out) {
+  out.resize(indices.size() * index_stride(type));
+  if (type == VK_INDEX_TYPE_UINT16) {
+    uint16_t *dst = reinterpret_cast<uint16_t *>(out.data());
+    for (size_t i = 0; i < indices.size(); ++i) {
+      dst[i] = (uint16_t)indices[i];
+    }
+  } else {
+    std::memcpy(out.data(), indices.data(), out.size());
+  }
+}
+
+size_t vertex_stride(VertexFormat format) {
+  switch (format) {
+  case VertexFormat::Packed:
+    return sizeof(PackedVertex);
+  case VertexFormat::Quantized:
+    return sizeof(QuantizedVertex);
+  default:
+    return sizeof(Vertex);
+  }
+}
+
+void pack_vertices(std::span<const Vertex> vertices, GPUMeshBuffers &mesh,
+                   std::vector<std::byte> &out) {
+  out.resize(vertices.size() * vertex_stride(mesh.vertexFormat));
+
+  switch (mesh.vertexFormat) {
+  case VertexFormat::Packed: {
+    PackedVertex *dst = reinterpret_cast<PackedVertex *>(out.data());
+    for (size_t i = 0; i < vertices.size(); ++i) {
+      const Vertex &v = vertices[i];
+      dst[i].position[0] = v.position.x;
+      dst[i].position[1] = v.position.y;
+      dst[i].position[2] = v.position.z;
+      pack_attributes(v, dst[i]);
+    }
+    break;
+  }
+  case VertexFormat::Quantized: {
+    glm::vec3 lo{0.f};
+    glm::vec3 hi{0.f};
+    if (!vertices.empty()) {
+      lo = hi = vertices[0].position;
+    }
+    for (const Vertex &v : vertices) {
+      lo = glm::min(lo, v.position);
+      hi = glm::max(hi, v.position);
+    }
+    mesh.positionOffset = lo;
+    mesh.positionScale = hi - lo;
+
+    // flat axes all land on 0, avoid dividing by their zero extent
+    glm::vec3 inv{0.f};
+    for (int c = 0; c < 3; ++c) {
+      if (mesh.positionScale[c] > 0.f) {
+        inv[c] = 1.f / mesh.positionScale[c];
+      }
+    }
+
+    QuantizedVertex *dst = reinterpret_cast<QuantizedVertex *>(out.data());
+    for (size_t i = 0; i < vertices.size(); ++i) {
+      const Vertex &v = vertices[i];
+      glm::vec3 q = glm::clamp((v.position - lo) * inv, 0.f, 1.f);
+      for (int c = 0; c < 3; ++c) {
+        dst[i].position[c] = (uint16_t)std::lround(q[c] * 65535.f);
+      }
+      dst[i].pad = 0;
+      pack_attributes(v, dst[i]);
+    }
+    break;
+  }
+  default:
+    std::memcpy(out.data(), vertices.data(), out.size());
+    break;
+  }
+}
+
+glm::mat4 dequantize_matrix(const GPUMeshBuffers &mesh) {
+  glm::mat4 m{1.f};
+  m[0][0] = mesh.positionScale.x;
+  m[1][1] = mesh.positionScale.y;
+  m[2][2] = mesh.positionScale.z;
+  m[3] = glm::vec4{mesh.positionOffset, 1.f};
+  return m;
+}
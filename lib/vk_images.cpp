@@ -17,8 +17,12 @@ void vkutil::transition_image(VkCommandBuffer cmd, VkImage image,
   imageBarrier.oldLayout = currentLayout;
   imageBarrier.newLayout = newLayout;
 
+  auto is_depth = [](VkImageLayout layout) {
+    return layout == VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL ||
+           layout == VK_IMAGE_LAYOUT_DEPTH_READ_ONLY_OPTIMAL;
+  };
   VkImageAspectFlags aspectMask =
-      (newLayout == VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL)
+      (is_depth(currentLayout) || is_depth(newLayout))
           ? VK_IMAGE_ASPECT_DEPTH_BIT
           : VK_IMAGE_ASPECT_COLOR_BIT;
   imageBarrier.subresourceRange = vkinit::image_subresource_range(aspectMask);
@@ -70,3 +74,55 @@ void vkutil::copy_image_to_image(VkCommandBuffer cmd, VkImage source,
 
   vkCmdBlitImage2(cmd, &blitInfo);
 }
+
+static void ownership_barrier(VkCommandBuffer cmd,
+                              VkImageMemoryBarrier2 &barrier, VkImage image,
+                              uint32_t srcFamily, uint32_t dstFamily,
+                              VkImageLayout oldLayout,
+                              VkImageLayout newLayout) {
+  barrier.srcQueueFamilyIndex = srcFamily;
+  barrier.dstQueueFamilyIndex = dstFamily;
+  barrier.oldLayout = oldLayout;
+  barrier.newLayout = newLayout;
+  barrier.image = image;
+  barrier.subresourceRange =
+      vkinit::image_subresource_range(VK_IMAGE_ASPECT_COLOR_BIT);
+
+  VkDependencyInfo depInfo{.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO};
+  depInfo.imageMemoryBarrierCount = 1;
+  depInfo.pImageMemoryBarriers = &barrier;
+
+  vkCmdPipelineBarrier2(cmd, &depInfo);
+}
+
+void vkutil::release_image(VkCommandBuffer cmd, VkImage image,
+                           uint32_t srcFamily, uint32_t dstFamily,
+                           VkImageLayout oldLayout, VkImageLayout newLayout,
+                           VkPipelineStageFlags2 srcStage,
+                           VkAccessFlags2 srcAccess) {
+  // the destination scope is ignored on the releasing queue
+  VkImageMemoryBarrier2 barrier{.sType =
+                                    VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2};
+  barrier.srcStageMask = srcStage;
+  barrier.srcAccessMask = srcAccess;
+  barrier.dstStageMask = VK_PIPELINE_STAGE_2_NONE;
+  barrier.dstAccessMask = VK_ACCESS_2_NONE;
+  ownership_barrier(cmd, barrier, image, srcFamily, dstFamily, oldLayout,
+                    newLayout);
+}
+
+void vkutil::acquire_image(VkCommandBuffer cmd, VkImage image,
+                           uint32_t srcFamily, uint32_t dstFamily,
+                           VkImageLayout oldLayout, VkImageLayout newLayout,
+                           VkPipelineStageFlags2 dstStage,
+                           VkAccessFlags2 dstAccess) {
+  // and the source scope on the acquiring one, the semaphore wait orders it
+  VkImageMemoryBarrier2 barrier{.sType =
+                                    VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2};
+  barrier.srcStageMask = VK_PIPELINE_STAGE_2_NONE;
+  barrier.srcAccessMask = VK_ACCESS_2_NONE;
+  barrier.dstStageMask = dstStage;
+  barrier.dstAccessMask = dstAccess;
+  ownership_barrier(cmd, barrier, image, srcFamily, dstFamily, oldLayout,
+                    newLayout);
+}
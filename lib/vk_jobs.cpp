@@ -0,0 +1,231 @@
+#include "vk_jobs.h"
+
+#include <algorithm>
+#include <optional>
+
+struct JobCounter {
+  // jobs of the handle that have not finished yet
+  std::atomic<size_t> pending;
+
+  std::mutex mutex;
+  bool done{false};
+  // run once pending reaches zero, they release dependent jobs
+  std::vector<std::function<void()>> continuations;
+};
+
+namespace {
+// lets enqueue() find the deque of the worker it is called from
+thread_local const JobSystem *tlsSystem = nullptr;
+thread_local size_t tlsQueue = 0;
+
+JobHandle make_counter(size_t pending) {
+  auto counter = std::make_shared<JobCounter>();
+  counter->pending = pending;
+  counter->done = pending == 0;
+  return counter;
+}
+
+void complete(JobCounter &counter) {
+  if (--counter.pending != 0) {
+    return;
+  }
+
+  std::vector<std::function<void()>> continuations;
+  {
+    std::lock_guard lock{counter.mutex};
+    counter.done = true;
+    continuations.swap(counter.continuations);
+  }
+  for (auto &continuation : continuations) {
+    continuation();
+  }
+}
+} // namespace
+
+JobSystem::JobSystem(unsigned workerCount) {
+  if (workerCount == 0) {
+    workerCount = std::max(1u, std::thread::hardware_concurrency()) - 1;
+  }
+
+  for (unsigned i = 0; i < workerCount + 1; ++i) {
+    _queues.push_back(std::make_unique<Queue>());
+  }
+  for (unsigned i = 0; i < workerCount; ++i) {
+    _workers.emplace_back([this, i]() { worker_main(i); });
+  }
+}
+
+JobSystem::~JobSystem() {
+  {
+    std::lock_guard lock{_sleepMutex};
+    _stopping = true;
+  }
+  _wake.notify_all();
+  for (std::thread &worker : _workers) {
+    worker.join();
+  }
+}
+
+JobHandle JobSystem::schedule(Job job,
+                              std::span<const JobHandle> dependencies) {
+  JobHandle counter = make_counter(1);
+  std::vector<Task> tasks;
+  tasks.push_back({std::move(job), counter});
+  return submit(std::move(tasks), counter, dependencies);
+}
+
+JobHandle JobSystem::parallel_for(size_t count, size_t grain, RangeJob job,
+                                  std::span<const JobHandle> dependencies) {
+  if (count == 0) {
+    return make_counter(0);
+  }
+  if (grain == 0) {
+    grain = std::max<size_t>(1, count / (thread_count() * 4));
+  }
+
+  size_t chunks = (count + grain - 1) / grain;
+  JobHandle counter = make_counter(chunks);
+
+  // the chunks share a single copy of the body
+  auto body = std::make_shared<RangeJob>(std::move(job));
+  std::vector<Task> tasks;
+  tasks.reserve(chunks);
+  for (size_t begin = 0; begin < count; begin += grain) {
+    size_t end = std::min(begin + grain, count);
+    tasks.push_back({[body, begin, end]() { (*body)(begin, end); }, counter});
+  }
+  return submit(std::move(tasks), counter, dependencies);
+}
+
+JobHandle JobSystem::submit(std::vector<Task> tasks, JobHandle counter,
+                            std::span<const JobHandle> dependencies) {
+  if (dependencies.empty()) {
+    enqueue(std::move(tasks));
+    return counter;
+  }
+
+  // the tasks are queued by whichever dependency completes last. the extra
+  // reference keeps them back until every continuation is registered
+  struct Deferred {
+    std::atomic<size_t> remaining;
+    std::vector<Task> tasks;
+  };
+  auto deferred = std::make_shared<Deferred>();
+  deferred->remaining = dependencies.size() + 1;
+  deferred->tasks = std::move(tasks);
+
+  auto release = [this, deferred]() {
+    if (--deferred->remaining == 0) {
+      enqueue(std::move(deferred->tasks));
+    }
+  };
+
+  for (const JobHandle &dependency : dependencies) {
+    bool done = true;
+    if (dependency) {
+      std::lock_guard lock{dependency->mutex};
+      done = dependency->done;
+      if (!done) {
+        dependency->continuations.push_back(release);
+      }
+    }
+    if (done) {
+      release();
+    }
+  }
+  release();
+
+  return counter;
+}
+
+void JobSystem::wait(const JobHandle &handle) {
+  size_t queue = tlsSystem == this ? tlsQueue : _queues.size() - 1;
+  while (!is_done(handle)) {
+    if (!try_run_one(queue)) {
+      std::this_thread::yield();
+    }
+  }
+}
+
+bool JobSystem::is_done(const JobHandle &handle) {
+  return !handle || handle->pending == 0;
+}
+
+void JobSystem::enqueue(std::vector<Task> tasks) {
+  if (tasks.empty()) {
+    return;
+  }
+
+  // counted before they become visible so a thief never sees it drop below
+  // zero
+  _queued += tasks.size();
+
+  Queue &queue = *_queues[tlsSystem == this ? tlsQueue : _queues.size() - 1];
+  {
+    std::lock_guard lock{queue.mutex};
+    for (Task &task : tasks) {
+      queue.tasks.push_back(std::move(task));
+    }
+  }
+
+  // taking the lock orders the notify after a sleeping worker's check
+  { std::lock_guard lock{_sleepMutex}; }
+  if (tasks.size() > 1) {
+    _wake.notify_all();
+  } else {
+    _wake.notify_one();
+  }
+}
+
+bool JobSystem::try_run_one(size_t queueIndex) {
+  std::optional<Task> task;
+
+  // newest own work first, it is the most likely to still be in cache
+  {
+    Queue &own = *_queues[queueIndex];
+    std::lock_guard lock{own.mutex};
+    if (!own.tasks.empty()) {
+      task = std::move(own.tasks.back());
+      own.tasks.pop_back();
+    }
+  }
+
+  // then the oldest work of everyone else
+  for (size_t i = 1; !task && i < _queues.size(); ++i) {
+    Queue &victim = *_queues[(queueIndex + i) % _queues.size()];
+    std::lock_guard lock{victim.mutex};
+    if (!victim.tasks.empty()) {
+      task = std::move(victim.tasks.front());
+      victim.tasks.pop_front();
+    }
+  }
+
+  if (!task) {
+    return false;
+  }
+  --_queued;
+  run(*task);
+  return true;
+}
+
+void JobSystem::run(Task &task) {
+  task.job();
+  complete(*task.counter);
+}
+
+void JobSystem::worker_main(size_t index) {
+  tlsSystem = this;
+  tlsQueue = index;
+
+  while (true) {
+    if (try_run_one(index)) {
+      continue;
+    }
+
+    std::unique_lock lock{_sleepMutex};
+    _wake.wait(lock, [&]() { return _stopping || _queued > 0; });
+    if (_stopping && _queued == 0) {
+      return;
+    }
+  }
+}
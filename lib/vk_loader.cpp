@@ -1,7 +1,9 @@
 #include "fastgltf/core.hpp"
 #include "stb_image.h"
 #include <iostream>
+#include <vk_jobs.h>
 #include <vk_loader.h>
+#include <vk_meshcache.h>
 
 #include "vk_engine.h"
 #include "vk_initializers.h"
@@ -12,9 +14,229 @@
 #include <fastgltf/glm_element_traits.hpp>
 #include <fastgltf/tools.hpp>
 
-std::optional<std::vector<std::shared_ptr<MeshAsset>>>
-loadGltfMeshes(VulkanEngine *engine, std::filesystem::path filePath) {
-  std::cout << "Loading GLTF: " << filePath << std::endl;
+#include <meshoptimizer.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+
+namespace {
+// replace the vertex colors with the normals, to display them
+constexpr bool OverrideColors = true;
+
+// cpu side copy of a mesh, filled by the decode workers and consumed by the
+// upload stage
+struct DecodedMesh {
+  std::string name;
+
+  std::vector<GeoSurface> surfaces;
+  std::vector<uint32_t> indices;
+  std::vector<Vertex> vertices;
+
+  // vertex cache and fetch statistics, before and after optimize_mesh
+  struct Stats {
+    float acmr;
+    float overfetch;
+  };
+  std::optional<Stats> before;
+  std::optional<Stats> after;
+};
+
+// the cache model the statistics are measured against
+constexpr unsigned VertexCacheSize = 16;
+// how much the vertex cache efficiency may worsen to reduce overdraw
+constexpr float OverdrawThreshold = 1.05f;
+
+DecodedMesh::Stats analyze_mesh(const DecodedMesh &mesh) {
+  meshopt_VertexCacheStatistics cache = meshopt_analyzeVertexCache(
+      mesh.indices.data(), mesh.indices.size(), mesh.vertices.size(),
+      VertexCacheSize, 0, 0);
+  meshopt_VertexFetchStatistics fetch = meshopt_analyzeVertexFetch(
+      mesh.indices.data(), mesh.indices.size(), mesh.vertices.size(),
+      sizeof(Vertex));
+  return {.acmr = cache.acmr, .overfetch = fetch.overfetch};
+}
+
+void optimize_mesh(DecodedMesh &mesh) {
+  if (mesh.indices.empty() || mesh.vertices.empty()) {
+    return;
+  }
+
+  mesh.before = analyze_mesh(mesh);
+
+  // triangles are only reordered within their surface, so the surface ranges
+  // stay valid
+  std::vector<uint32_t> scratch;
+  for (const GeoSurface &surface : mesh.surfaces) {
+    uint32_t *indices = mesh.indices.data() + surface.startIndex;
+
+    scratch.assign(indices, indices + surface.count);
+    meshopt_optimizeVertexCache(indices, scratch.data(), surface.count,
+                                mesh.vertices.size());
+
+    scratch.assign(indices, indices + surface.count);
+    meshopt_optimizeOverdraw(indices, scratch.data(), surface.count,
+                             &mesh.vertices[0].position.x,
+                             mesh.vertices.size(), sizeof(Vertex),
+                             OverdrawThreshold);
+  }
+
+  // lay vertices out in the order the indices first reference them, dropping
+  // the ones nothing references
+  std::vector<Vertex> fetchOrdered(mesh.vertices.size());
+  size_t vertexCount = meshopt_optimizeVertexFetch(
+      fetchOrdered.data(), mesh.indices.data(), mesh.indices.size(),
+      mesh.vertices.data(), mesh.vertices.size(), sizeof(Vertex));
+  fetchOrdered.resize(vertexCount);
+  mesh.vertices = std::move(fetchOrdered);
+
+  mesh.after = analyze_mesh(mesh);
+}
+
+void decode_mesh(const fastgltf::Asset &gltf, const fastgltf::Mesh &mesh,
+                 DecodedMesh &out) {
+  out.name = mesh.name;
+
+  std::vector<uint32_t> &indices = out.indices;
+  std::vector<Vertex> &vertices = out.vertices;
+
+  for (auto &&p : mesh.primitives) {
+    GeoSurface newSurface;
+    newSurface.startIndex = (uint32_t)indices.size();
+    newSurface.count =
+        (uint32_t)gltf.accessors[p.indicesAccessor.value()].count;
+
+    size_t initial_vtx = vertices.size();
+
+    // load indexes
+    {
+      const fastgltf::Accessor &indexaccessor =
+          gltf.accessors[p.indicesAccessor.value()];
+      indices.reserve(indices.size() + indexaccessor.count);
+
+      fastgltf::iterateAccessor<std::uint32_t>(
+          gltf, indexaccessor,
+          [&](std::uint32_t idx) { indices.push_back(idx + initial_vtx); });
+    }
+
+    // load vertex positions
+    {
+      const fastgltf::Accessor &posAccessor =
+          gltf.accessors[p.findAttribute("POSITION")->accessorIndex];
+      vertices.resize(vertices.size() + posAccessor.count);
+
+      fastgltf::iterateAccessorWithIndex<glm::vec3>(
+          gltf, posAccessor, [&](glm::vec3 v, size_t index) {
+            Vertex newvtx;
+            newvtx.position = v;
+            newvtx.normal = {1, 0, 0};
+            newvtx.color = glm::vec4{1.f};
+            newvtx.uv_x = 0;
+            newvtx.uv_y = 0;
+            vertices[initial_vtx + index] = newvtx;
+          });
+    }
+
+    // load vertex normals
+    auto normals = p.findAttribute("NORMAL");
+    if (normals != p.attributes.end()) {
+
+      fastgltf::iterateAccessorWithIndex<glm::vec3>(
+          gltf, gltf.accessors[normals->accessorIndex],
+          [&](glm::vec3 v, size_t index) {
+            vertices[initial_vtx + index].normal = v;
+          });
+    }
+
+    // load UVs
+    auto uv = p.findAttribute("TEXCOORD_0");
+    if (uv != p.attributes.end()) {
+
+      fastgltf::iterateAccessorWithIndex<glm::vec2>(
+          gltf, gltf.accessors[uv->accessorIndex],
+          [&](glm::vec2 v, size_t index) {
+            vertices[initial_vtx + index].uv_x = v.x;
+            vertices[initial_vtx + index].uv_y = v.y;
+          });
+    }
+
+    // load vertex colors
+    auto colors = p.findAttribute("COLOR_0");
+    if (colors != p.attributes.end()) {
+
+      fastgltf::iterateAccessorWithIndex<glm::vec4>(
+          gltf, gltf.accessors[colors->accessorIndex],
+          [&](glm::vec4 v, size_t index) {
+            vertices[initial_vtx + index].color = v;
+          });
+    }
+    out.surfaces.push_back(newSurface);
+  }
+
+  // display the vertex normals
+  if (OverrideColors) {
+    for (Vertex &vtx : vertices) {
+      vtx.color = glm::vec4(vtx.normal, 1.f);
+    }
+  }
+}
+
+// box around each surface's vertices, and the sphere around its center
+void compute_bounds(DecodedMesh &mesh) {
+  for (GeoSurface &surface : mesh.surfaces) {
+    std::span<const uint32_t> indices{mesh.indices.data() + surface.startIndex,
+                                      surface.count};
+    if (indices.empty()) {
+      surface.bounds = {};
+      continue;
+    }
+
+    glm::vec3 minpos = mesh.vertices[indices[0]].position;
+    glm::vec3 maxpos = minpos;
+    for (uint32_t i : indices) {
+      minpos = glm::min(minpos, mesh.vertices[i].position);
+      maxpos = glm::max(maxpos, mesh.vertices[i].position);
+    }
+
+    surface.bounds.origin = (maxpos + minpos) / 2.f;
+    surface.bounds.extents = (maxpos - minpos) / 2.f;
+    float radius2 = 0.f;
+    for (uint32_t i : indices) {
+      glm::vec3 d = mesh.vertices[i].position - surface.bounds.origin;
+      radius2 = std::max(radius2, glm::dot(d, d));
+    }
+    surface.bounds.sphereRadius = std::sqrt(radius2);
+  }
+}
+
+double elapsed_ms(std::chrono::steady_clock::time_point start,
+                  std::chrono::steady_clock::time_point end) {
+  return std::chrono::duration<double, std::milli>(end - start).count();
+}
+
+// bits stored in the mesh cache, a cache is only reused when they match the
+// way the source would be decoded now
+uint32_t cache_flags(const GltfLoadOptions &options) {
+  uint32_t flags = 0;
+  if (OverrideColors) {
+    flags |= 1u << 0;
+  }
+  if (options.optimizeMeshes) {
+    flags |= 1u << 1;
+  }
+  return flags;
+}
+
+std::filesystem::path cache_path(const std::filesystem::path &filePath) {
+  std::filesystem::path path = filePath;
+  path += ".meshcache";
+  return path;
+}
+
+std::optional<std::vector<DecodedMesh>>
+decode_gltf(const std::filesystem::path &filePath,
+            const GltfLoadOptions &options) {
+  auto parseStart = std::chrono::steady_clock::now();
 
   auto data = fastgltf::GltfDataBuffer::FromPath(filePath);
 
@@ -40,105 +262,159 @@ loadGltfMeshes(VulkanEngine *engine, std::filesystem::path filePath) {
 
   gltf = std::move(load.get());
 
-  std::vector<std::shared_ptr<MeshAsset>> meshes;
+  // decode every mesh into its own cpu buffers. every mesh is its own job so
+  // big and small meshes balance across workers
+  auto decodeStart = std::chrono::steady_clock::now();
 
-  // use the same vectors for all meshes so that the memory doesnt reallocate as
-  // often
-  std::vector<uint32_t> indices;
-  std::vector<Vertex> vertices;
-  for (fastgltf::Mesh &mesh : gltf.meshes) {
-    MeshAsset newmesh;
+  std::vector<DecodedMesh> decoded(gltf.meshes.size());
 
-    newmesh.name = mesh.name;
+  auto decodeMeshes = [&](size_t begin, size_t end) {
+    for (size_t i = begin; i < end; ++i) {
+      decode_mesh(gltf, gltf.meshes[i], decoded[i]);
+      if (options.optimizeMeshes) {
+        optimize_mesh(decoded[i]);
+      }
+      compute_bounds(decoded[i]);
+    }
+  };
 
-    // clear the mesh arrays each mesh, we dont want to merge them by error
-    indices.clear();
-    vertices.clear();
+  unsigned workerCount = 1;
+  if (options.workerCount == 1) {
+    decodeMeshes(0, decoded.size());
+  } else if (options.jobs) {
+    workerCount = options.jobs->thread_count();
+    options.jobs->wait(
+        options.jobs->parallel_for(decoded.size(), 1, decodeMeshes));
+  } else {
+    // the calling thread takes part in wait(), so one less worker
+    JobSystem jobs{options.workerCount == 0 ? 0 : options.workerCount - 1};
+    workerCount = jobs.thread_count();
+    jobs.wait(jobs.parallel_for(decoded.size(), 1, decodeMeshes));
+  }
 
-    for (auto &&p : mesh.primitives) {
-      GeoSurface newSurface;
-      newSurface.startIndex = (uint32_t)indices.size();
-      newSurface.count =
-          (uint32_t)gltf.accessors[p.indicesAccessor.value()].count;
+  auto end = std::chrono::steady_clock::now();
+  fmt::println("Decoded {} meshes: parse {:.2f} ms, decode {:.2f} ms on {} "
+               "thread(s)",
+               decoded.size(), elapsed_ms(parseStart, decodeStart),
+               elapsed_ms(decodeStart, end), workerCount);
 
-      size_t initial_vtx = vertices.size();
+  for (const DecodedMesh &mesh : decoded) {
+    if (mesh.before && mesh.after) {
+      fmt::println("  {}: ACMR {:.3f} -> {:.3f}, overfetch {:.3f} -> {:.3f}",
+                   mesh.name, mesh.before->acmr, mesh.after->acmr,
+                   mesh.before->overfetch, mesh.after->overfetch);
+    }
+  }
 
-      // load indexes
-      {
-        fastgltf::Accessor &indexaccessor =
-            gltf.accessors[p.indicesAccessor.value()];
-        indices.reserve(indices.size() + indexaccessor.count);
+  return decoded;
+}
 
-        fastgltf::iterateAccessor<std::uint32_t>(
-            gltf, indexaccessor,
-            [&](std::uint32_t idx) { indices.push_back(idx + initial_vtx); });
-      }
+std::vector<CachedMesh> view_meshes(const std::vector<DecodedMesh> &decoded) {
+  std::vector<CachedMesh> views;
+  views.reserve(decoded.size());
+  for (const DecodedMesh &mesh : decoded) {
+    views.push_back({.name = mesh.name,
+                     .surfaces = mesh.surfaces,
+                     .vertices = mesh.vertices,
+                     .indices = mesh.indices});
+  }
+  return views;
+}
 
-      // load vertex positions
-      {
-        fastgltf::Accessor &posAccessor =
-            gltf.accessors[p.findAttribute("POSITION")->accessorIndex];
-        vertices.resize(vertices.size() + posAccessor.count);
-
-        fastgltf::iterateAccessorWithIndex<glm::vec3>(
-            gltf, posAccessor, [&](glm::vec3 v, size_t index) {
-              Vertex newvtx;
-              newvtx.position = v;
-              newvtx.normal = {1, 0, 0};
-              newvtx.color = glm::vec4{1.f};
-              newvtx.uv_x = 0;
-              newvtx.uv_y = 0;
-              vertices[initial_vtx + index] = newvtx;
-            });
-      }
+// hands the meshes to the gpu in a single batch
+std::vector<std::shared_ptr<MeshAsset>>
+upload_meshes(VulkanEngine *engine, std::span<const CachedMesh> source) {
+  std::vector<MeshUploadInfo> uploads;
+  uploads.reserve(source.size());
+  for (const CachedMesh &mesh : source) {
+    uploads.push_back({.indices = mesh.indices, .vertices = mesh.vertices});
+  }
 
-      // load vertex normals
-      auto normals = p.findAttribute("NORMAL");
-      if (normals != p.attributes.end()) {
+  std::vector<GPUMeshBuffers> buffers = engine->uploadMeshes(uploads);
 
-        fastgltf::iterateAccessorWithIndex<glm::vec3>(
-            gltf, gltf.accessors[normals->accessorIndex],
-            [&](glm::vec3 v, size_t index) {
-              vertices[initial_vtx + index].normal = v;
-            });
-      }
+  std::vector<std::shared_ptr<MeshAsset>> meshes;
+  meshes.reserve(source.size());
+
+  for (size_t i = 0; i < source.size(); ++i) {
+    MeshAsset newmesh;
+    newmesh.name = source[i].name;
+    newmesh.surfaces.assign(source[i].surfaces.begin(),
+                            source[i].surfaces.end());
+    newmesh.meshBuffers = buffers[i];
 
-      // load UVs
-      auto uv = p.findAttribute("TEXCOORD_0");
-      if (uv != p.attributes.end()) {
+    meshes.emplace_back(std::make_shared<MeshAsset>(std::move(newmesh)));
+  }
+  return meshes;
+}
+} // namespace
 
-        fastgltf::iterateAccessorWithIndex<glm::vec2>(
-            gltf, gltf.accessors[uv->accessorIndex],
-            [&](glm::vec2 v, size_t index) {
-              vertices[initial_vtx + index].uv_x = v.x;
-              vertices[initial_vtx + index].uv_y = v.y;
-            });
-      }
+std::optional<std::vector<std::shared_ptr<MeshAsset>>>
+loadGltfMeshes(VulkanEngine *engine, std::filesystem::path filePath,
+               const GltfLoadOptions &options) {
+  std::cout << "Loading GLTF: " << filePath << std::endl;
 
-      // load vertex colors
-      auto colors = p.findAttribute("COLOR_0");
-      if (colors != p.attributes.end()) {
+  auto start = std::chrono::steady_clock::now();
 
-        fastgltf::iterateAccessorWithIndex<glm::vec4>(
-            gltf, gltf.accessors[colors->accessorIndex],
-            [&](glm::vec4 v, size_t index) {
-              vertices[initial_vtx + index].color = v;
-            });
-      }
-      newmesh.surfaces.push_back(newSurface);
-    }
+  // a cache cooked from the same file skips parsing entirely, its blobs are
+  // copied from the mapping straight into staging memory
+  const std::filesystem::path meshCachePath = cache_path(filePath);
+  uint64_t sourceHash = 0;
+  if (options.useMeshCache) {
+    sourceHash = hash_file(filePath);
 
-    // display the vertex normals
-    constexpr bool OverrideColors = true;
-    if (OverrideColors) {
-      for (Vertex &vtx : vertices) {
-        vtx.color = glm::vec4(vtx.normal, 1.f);
-      }
+    if (auto cache =
+            MeshCache::open(meshCachePath, sourceHash, cache_flags(options))) {
+      auto uploadStart = std::chrono::steady_clock::now();
+      auto meshes = upload_meshes(engine, cache->meshes);
+      auto end = std::chrono::steady_clock::now();
+
+      fmt::println("Loaded {} meshes from {} in {:.2f} ms: open {:.2f} ms, "
+                   "upload {:.2f} ms",
+                   meshes.size(), meshCachePath.string(),
+                   elapsed_ms(start, end), elapsed_ms(start, uploadStart),
+                   elapsed_ms(uploadStart, end));
+      return meshes;
     }
-    newmesh.meshBuffers = engine->uploadMesh(indices, vertices);
+  }
 
-    meshes.emplace_back(std::make_shared<MeshAsset>(std::move(newmesh)));
+  auto decoded = decode_gltf(filePath, options);
+  if (!decoded) {
+    return {};
+  }
+
+  std::vector<CachedMesh> views = view_meshes(*decoded);
+
+  if (options.useMeshCache &&
+      !MeshCache::write(meshCachePath, sourceHash, cache_flags(options),
+                        views)) {
+    fmt::println("Failed to write mesh cache {}", meshCachePath.string());
   }
 
+  auto uploadStart = std::chrono::steady_clock::now();
+  auto meshes = upload_meshes(engine, views);
+  auto end = std::chrono::steady_clock::now();
+
+  fmt::println("Loaded {} meshes in {:.2f} ms, upload {:.2f} ms",
+               meshes.size(), elapsed_ms(start, end),
+               elapsed_ms(uploadStart, end));
+
   return meshes;
-}
\ No newline at end of file
+}
+
+bool cookGltfMeshes(std::filesystem::path filePath,
+                    const GltfLoadOptions &options) {
+  auto decoded = decode_gltf(filePath, options);
+  if (!decoded) {
+    return false;
+  }
+
+  const std::filesystem::path meshCachePath = cache_path(filePath);
+  if (!MeshCache::write(meshCachePath, hash_file(filePath),
+                        cache_flags(options), view_meshes(*decoded))) {
+    fmt::println("Failed to write mesh cache {}", meshCachePath.string());
+    return false;
+  }
+
+  fmt::println("Cooked {}", meshCachePath.string());
+  return true;
+}
@@ -0,0 +1,258 @@
+#include "vk_meshcache.h"
+
+#include <cstring>
+#include <fstream>
+
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace {
+constexpr uint32_t MESH_CACHE_MAGIC = 0x4d4b5053; // "SPKM"
+constexpr uint32_t MESH_CACHE_VERSION = 3;
+// every blob in the file starts on this boundary
+constexpr uint64_t MESH_CACHE_ALIGNMENT = 16;
+
+struct MeshCacheHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint64_t sourceHash;
+  uint32_t flags;
+  uint32_t meshCount;
+  // layout checks, so a cache cooked by an older build is rejected
+  uint32_t vertexSize;
+  uint32_t surfaceSize;
+};
+
+// offsets are in bytes from the start of the file
+struct MeshCacheEntry {
+  uint64_t nameOffset;
+  uint64_t nameLength;
+  uint64_t surfaceOffset;
+  uint64_t surfaceCount;
+  uint64_t vertexOffset;
+  uint64_t vertexCount;
+  uint64_t indexOffset;
+  uint64_t indexCount;
+};
+
+uint64_t align_up(uint64_t value) {
+  return (value + MESH_CACHE_ALIGNMENT - 1) / MESH_CACHE_ALIGNMENT *
+         MESH_CACHE_ALIGNMENT;
+}
+
+// true if [offset, offset + count * stride) lies inside the file
+bool in_bounds(uint64_t offset, uint64_t count, uint64_t stride,
+               size_t fileSize) {
+  if (offset > fileSize) {
+    return false;
+  }
+  return count <= (fileSize - offset) / stride;
+}
+} // namespace
+
+std::shared_ptr<MappedFile>
+MappedFile::open(const std::filesystem::path &path) {
+  std::shared_ptr<MappedFile> file{new MappedFile};
+
+#if !defined(_WIN32)
+  int fd = ::open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return nullptr;
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size == 0) {
+    ::close(fd);
+    return nullptr;
+  }
+
+  void *mapping = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  // the mapping keeps the file alive on its own
+  ::close(fd);
+  if (mapping == MAP_FAILED) {
+    return nullptr;
+  }
+
+  file->_data = (const std::byte *)mapping;
+  file->_size = (size_t)st.st_size;
+#else
+  std::ifstream stream(path, std::ios::ate | std::ios::binary);
+  if (!stream.is_open()) {
+    return nullptr;
+  }
+
+  file->_fallback.resize((size_t)stream.tellg());
+  stream.seekg(0);
+  stream.read((char *)file->_fallback.data(), file->_fallback.size());
+
+  file->_data = file->_fallback.data();
+  file->_size = file->_fallback.size();
+#endif
+
+  return file;
+}
+
+MappedFile::~MappedFile() noexcept {
+#if !defined(_WIN32)
+  if (_data) {
+    munmap((void *)_data, _size);
+  }
+#endif
+}
+
+std::optional<MeshCache> MeshCache::open(const std::filesystem::path &path,
+                                         uint64_t sourceHash, uint32_t flags) {
+  auto file = MappedFile::open(path);
+  if (!file || file->size() < sizeof(MeshCacheHeader)) {
+    return {};
+  }
+
+  MeshCacheHeader header;
+  memcpy(&header, file->data(), sizeof(header));
+
+  if (header.magic != MESH_CACHE_MAGIC ||
+      header.version != MESH_CACHE_VERSION ||
+      header.sourceHash != sourceHash || header.flags != flags ||
+      header.vertexSize != sizeof(Vertex) ||
+      header.surfaceSize != sizeof(GeoSurface) ||
+      !in_bounds(sizeof(MeshCacheHeader), header.meshCount,
+                 sizeof(MeshCacheEntry), file->size())) {
+    return {};
+  }
+
+  MeshCache cache;
+  cache.file = file;
+  cache.meshes.reserve(header.meshCount);
+
+  const std::byte *base = file->data();
+  for (uint32_t i = 0; i < header.meshCount; ++i) {
+    MeshCacheEntry entry;
+    memcpy(&entry,
+           base + sizeof(MeshCacheHeader) + i * sizeof(MeshCacheEntry),
+           sizeof(entry));
+
+    if (!in_bounds(entry.nameOffset, entry.nameLength, 1, file->size()) ||
+        !in_bounds(entry.surfaceOffset, entry.surfaceCount,
+                   sizeof(GeoSurface), file->size()) ||
+        !in_bounds(entry.vertexOffset, entry.vertexCount, sizeof(Vertex),
+                   file->size()) ||
+        !in_bounds(entry.indexOffset, entry.indexCount, sizeof(uint32_t),
+                   file->size())) {
+      return {};
+    }
+
+    cache.meshes.push_back(CachedMesh{
+        .name = {(const char *)base + entry.nameOffset, entry.nameLength},
+        .surfaces = {(const GeoSurface *)(base + entry.surfaceOffset),
+                     entry.surfaceCount},
+        .vertices = {(const Vertex *)(base + entry.vertexOffset),
+                     entry.vertexCount},
+        .indices = {(const uint32_t *)(base + entry.indexOffset),
+                    entry.indexCount},
+    });
+  }
+
+  return cache;
+}
+
+bool MeshCache::write(const std::filesystem::path &path, uint64_t sourceHash,
+                      uint32_t flags, std::span<const CachedMesh> meshes) {
+  MeshCacheHeader header{};
+  header.magic = MESH_CACHE_MAGIC;
+  header.version = MESH_CACHE_VERSION;
+  header.sourceHash = sourceHash;
+  header.flags = flags;
+  header.meshCount = (uint32_t)meshes.size();
+  header.vertexSize = sizeof(Vertex);
+  header.surfaceSize = sizeof(GeoSurface);
+
+  // lay out the blobs after the header and the entry table
+  std::vector<MeshCacheEntry> entries(meshes.size());
+  uint64_t offset = sizeof(MeshCacheHeader) +
+                    meshes.size() * sizeof(MeshCacheEntry);
+  auto place = [&](uint64_t bytes) {
+    offset = align_up(offset);
+    uint64_t placed = offset;
+    offset += bytes;
+    return placed;
+  };
+
+  for (size_t i = 0; i < meshes.size(); ++i) {
+    const CachedMesh &mesh = meshes[i];
+    MeshCacheEntry &entry = entries[i];
+
+    entry.nameLength = mesh.name.size();
+    entry.nameOffset = place(mesh.name.size());
+    entry.surfaceCount = mesh.surfaces.size();
+    entry.surfaceOffset = place(mesh.surfaces.size_bytes());
+    entry.vertexCount = mesh.vertices.size();
+    entry.vertexOffset = place(mesh.vertices.size_bytes());
+    entry.indexCount = mesh.indices.size();
+    entry.indexOffset = place(mesh.indices.size_bytes());
+  }
+
+  // write next to the target and rename, so readers never see half a file
+  std::filesystem::path tmpPath = path;
+  tmpPath += ".tmp";
+  {
+    std::ofstream file(tmpPath, std::ios::binary | std::ios::trunc);
+    if (!file.is_open()) {
+      return false;
+    }
+
+    uint64_t written = 0;
+    auto write_at = [&](uint64_t at, const void *data, uint64_t bytes) {
+      static constexpr char zeros[MESH_CACHE_ALIGNMENT] = {};
+      file.write(zeros, at - written);
+      file.write((const char *)data, bytes);
+      written = at + bytes;
+    };
+
+    write_at(0, &header, sizeof(header));
+    write_at(written, entries.data(), entries.size() * sizeof(MeshCacheEntry));
+
+    for (size_t i = 0; i < meshes.size(); ++i) {
+      const CachedMesh &mesh = meshes[i];
+      const MeshCacheEntry &entry = entries[i];
+
+      write_at(entry.nameOffset, mesh.name.data(), mesh.name.size());
+      write_at(entry.surfaceOffset, mesh.surfaces.data(),
+               mesh.surfaces.size_bytes());
+      write_at(entry.vertexOffset, mesh.vertices.data(),
+               mesh.vertices.size_bytes());
+      write_at(entry.indexOffset, mesh.indices.data(),
+               mesh.indices.size_bytes());
+    }
+
+    if (!file) {
+      return false;
+    }
+  }
+
+  std::error_code ec;
+  std::filesystem::rename(tmpPath, path, ec);
+  return !ec;
+}
+
+uint64_t hash_file(const std::filesystem::path &path) {
+  std::ifstream file(path, std::ios::binary);
+  if (!file.is_open()) {
+    return 0;
+  }
+
+  uint64_t hash = 14695981039346656037ull;
+  std::vector<char> chunk(1 << 16);
+  while (file) {
+    file.read(chunk.data(), chunk.size());
+    std::streamsize count = file.gcount();
+    for (std::streamsize i = 0; i < count; ++i) {
+      hash ^= (uint8_t)chunk[i];
+      hash *= 1099511628211ull;
+    }
+  }
+  return hash;
+}
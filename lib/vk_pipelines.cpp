@@ -1,8 +1,120 @@
+#include <cstring>
 #include <fstream>
 #include <vk_initializers.h>
 #include <vk_pipelines.h>
 
 namespace vkutil {
+namespace {
+// prefix of the pipeline cache file, identifying the gpu and driver that
+// produced the blob that follows it
+struct PipelineCacheFileHeader {
+  uint32_t magic;
+  uint32_t dataSize;
+  uint32_t vendorID;
+  uint32_t deviceID;
+  uint32_t driverVersion;
+  uint8_t pipelineCacheUUID[VK_UUID_SIZE];
+};
+
+constexpr uint32_t PIPELINE_CACHE_MAGIC = 0x53504b43; // "SPKC"
+
+PipelineCacheFileHeader make_cache_header(VkPhysicalDevice gpu) {
+  VkPhysicalDeviceProperties props;
+  vkGetPhysicalDeviceProperties(gpu, &props);
+
+  PipelineCacheFileHeader header{};
+  header.magic = PIPELINE_CACHE_MAGIC;
+  header.vendorID = props.vendorID;
+  header.deviceID = props.deviceID;
+  header.driverVersion = props.driverVersion;
+  memcpy(header.pipelineCacheUUID, props.pipelineCacheUUID, VK_UUID_SIZE);
+  return header;
+}
+} // namespace
+
+VkPipelineCache load_pipeline_cache(std::filesystem::path filePath,
+                                    VkDevice device, VkPhysicalDevice gpu,
+                                    bool *outWarm) {
+  const PipelineCacheFileHeader expected = make_cache_header(gpu);
+
+  std::vector<char> data;
+
+  std::ifstream file(filePath, std::ios::binary);
+  PipelineCacheFileHeader header{};
+  if (file.is_open() && file.read((char *)&header, sizeof(header))) {
+    // a truncated or corrupt header can claim any size, check it against
+    // the file before allocating
+    std::error_code ec;
+    uintmax_t fileSize = std::filesystem::file_size(filePath, ec);
+    bool sizeMatches = !ec && fileSize - sizeof(header) == header.dataSize;
+
+    // reject caches written by another gpu or driver build
+    if (sizeMatches && header.magic == expected.magic &&
+        header.vendorID == expected.vendorID &&
+        header.deviceID == expected.deviceID &&
+        header.driverVersion == expected.driverVersion &&
+        memcmp(header.pipelineCacheUUID, expected.pipelineCacheUUID,
+               VK_UUID_SIZE) == 0) {
+      data.resize(header.dataSize);
+      if (!file.read(data.data(), data.size())) {
+        data.clear();
+      }
+    } else {
+      fmt::println("Ignoring stale pipeline cache {}", filePath.string());
+    }
+  }
+
+  VkPipelineCacheCreateInfo info = {
+      .sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO};
+  info.initialDataSize = data.size();
+  info.pInitialData = data.empty() ? nullptr : data.data();
+
+  VkPipelineCache cache;
+  if (vkCreatePipelineCache(device, &info, nullptr, &cache) != VK_SUCCESS) {
+    // the driver may still refuse the blob, fall back to an empty cache
+    data.clear();
+    info.initialDataSize = 0;
+    info.pInitialData = nullptr;
+    VK_CHECK(vkCreatePipelineCache(device, &info, nullptr, &cache));
+  }
+
+  if (outWarm) {
+    *outWarm = !data.empty();
+  }
+  return cache;
+}
+
+bool save_pipeline_cache(std::filesystem::path filePath, VkDevice device,
+                         VkPhysicalDevice gpu, VkPipelineCache cache) {
+  size_t dataSize = 0;
+  VK_CHECK(vkGetPipelineCacheData(device, cache, &dataSize, nullptr));
+
+  std::vector<char> data(dataSize);
+  VK_CHECK(vkGetPipelineCacheData(device, cache, &dataSize, data.data()));
+
+  PipelineCacheFileHeader header = make_cache_header(gpu);
+  header.dataSize = (uint32_t)dataSize;
+
+  // write next to the target and rename, so a crash never leaves half a cache
+  std::filesystem::path tmpPath = filePath;
+  tmpPath += ".tmp";
+  {
+    std::ofstream file(tmpPath, std::ios::binary | std::ios::trunc);
+    if (!file.is_open()) {
+      return false;
+    }
+    file.write((const char *)&header, sizeof(header));
+    file.write(data.data(), dataSize);
+    if (!file) {
+      return false;
+    }
+  }
+
+  std::error_code ec;
+  std::filesystem::rename(tmpPath, filePath, ec);
+  return !ec;
+}
+
 bool load_shader_module(std::filesystem::path filePath, VkDevice device,
                         VkShaderModule *outShaderModule) {
   // open the file. With cursor at the end
@@ -73,7 +185,8 @@ void PipelineBuilder::clear() {
   _shaderStages.clear();
 }
 
-VkPipeline PipelineBuilder::build_pipeline(VkDevice device) {
+VkPipeline PipelineBuilder::build_pipeline(VkDevice device,
+                                           VkPipelineCache cache) {
   // make viewport state from our stored viewport and scissor.
   // at the moment we wont support multiple viewports or scissors
   VkPipelineViewportStateCreateInfo viewportState = {};
@@ -131,8 +244,8 @@ VkPipeline PipelineBuilder::build_pipeline(VkDevice device) {
   // its easy to error out on create graphics pipeline, so we handle it a bit
   // better than the common VK_CHECK case
   VkPipeline newPipeline;
-  if (vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1, &pipelineInfo,
-                                nullptr, &newPipeline) != VK_SUCCESS) {
+  if (vkCreateGraphicsPipelines(device, cache, 1, &pipelineInfo, nullptr,
+                                &newPipeline) != VK_SUCCESS) {
     fmt::println("failed to create pipeline");
     return VK_NULL_HANDLE; // failed to create graphics pipeline
   } else {
@@ -0,0 +1,156 @@
+#include "vk_profiler.h"
+
+#include <algorithm>
+
+void GpuProfiler::init(VkDevice device, VkPhysicalDevice physicalDevice,
+                       std::span<const uint32_t> queueFamilies,
+                       uint32_t frameCount) {
+  _device = device;
+
+  VkPhysicalDeviceProperties properties;
+  vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+
+  uint32_t familyCount = 0;
+  vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &familyCount,
+                                           nullptr);
+  std::vector<VkQueueFamilyProperties> families(familyCount);
+  vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &familyCount,
+                                           families.data());
+
+  // ticks only compare within the bits every family keeps
+  uint32_t validBits = 64;
+  for (uint32_t family : queueFamilies) {
+    validBits = std::min(validBits, families[family].timestampValidBits);
+  }
+  if (validBits == 0) {
+    fmt::println("Timestamps are not supported, the gpu profiler is off");
+    return;
+  }
+  _timestampPeriod = properties.limits.timestampPeriod;
+  _timestampMask = validBits == 64 ? ~0ull : (1ull << validBits) - 1;
+
+  VkQueryPoolCreateInfo poolInfo{.sType =
+                                     VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO};
+  poolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+  poolInfo.queryCount = MAX_SCOPES * 2;
+
+  _frames.resize(frameCount);
+  for (Frame &frame : _frames) {
+    VK_CHECK(vkCreateQueryPool(_device, &poolInfo, nullptr, &frame.pool));
+    // queries have to be reset before their first use
+    vkResetQueryPool(_device, frame.pool, 0, MAX_SCOPES * 2);
+  }
+}
+
+void GpuProfiler::destroy() {
+  for (Frame &frame : _frames) {
+    vkDestroyQueryPool(_device, frame.pool, nullptr);
+  }
+  _frames.clear();
+}
+
+void GpuProfiler::begin_frame(uint32_t frameIndex) {
+  if (!enabled()) {
+    return;
+  }
+
+  _current = frameIndex;
+  Frame &frame = _frames[frameIndex];
+  if (frame.names.empty()) {
+    return;
+  }
+
+  // each value followed by its availability. scopes that were begun but not
+  // ended stay unavailable and are skipped
+  uint32_t queryCount = (uint32_t)frame.names.size() * 2;
+  std::vector<uint64_t> results(queryCount * 2);
+  VkResult result = vkGetQueryPoolResults(
+      _device, frame.pool, 0, queryCount, results.size() * sizeof(uint64_t),
+      results.data(), 2 * sizeof(uint64_t),
+      VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WITH_AVAILABILITY_BIT);
+  if (result != VK_NOT_READY) {
+    VK_CHECK(result);
+  }
+
+  for (size_t i = 0; i < frame.names.size(); ++i) {
+    const uint64_t *begin = &results[i * 4];
+    const uint64_t *end = &results[i * 4 + 2];
+    if (begin[1] == 0 || end[1] == 0) {
+      continue;
+    }
+    uint64_t ticks = (end[0] - begin[0]) & _timestampMask;
+    record(frame.names[i], ticks * _timestampPeriod / 1e6);
+  }
+
+  vkResetQueryPool(_device, frame.pool, 0, queryCount);
+  frame.names.clear();
+}
+
+GpuProfiler::ScopeId GpuProfiler::begin_scope(VkCommandBuffer cmd,
+                                              std::string name) {
+  if (!enabled()) {
+    return NO_SCOPE;
+  }
+
+  Frame &frame = _frames[_current];
+  if (frame.names.size() == MAX_SCOPES) {
+    return NO_SCOPE;
+  }
+
+  // waits for the work before it, so back to back scopes do not overlap
+  ScopeId scope = (ScopeId)frame.names.size();
+  frame.names.push_back(std::move(name));
+  vkCmdWriteTimestamp2(cmd, VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT, frame.pool,
+                       scope * 2);
+  return scope;
+}
+
+void GpuProfiler::end_scope(VkCommandBuffer cmd, ScopeId scope) {
+  if (scope == NO_SCOPE) {
+    return;
+  }
+  vkCmdWriteTimestamp2(cmd, VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT,
+                       _frames[_current].pool, scope * 2 + 1);
+}
+
+void GpuProfiler::record(const std::string &name, double milliseconds) {
+  auto [it, inserted] = _history.try_emplace(name);
+  if (inserted) {
+    _order.push_back(name);
+  }
+
+  History &history = it->second;
+  if (history.samples.size() < HISTORY_SIZE) {
+    history.samples.push_back(milliseconds);
+  } else {
+    history.samples[history.next] = milliseconds;
+  }
+  history.next = (history.next + 1) % HISTORY_SIZE;
+}
+
+std::vector<GpuProfiler::ScopeStats> GpuProfiler::stats() const {
+  std::vector<ScopeStats> stats;
+  std::vector<double> sorted;
+  for (const std::string &name : _order) {
+    const History &history = _history.at(name);
+    sorted = history.samples;
+    std::sort(sorted.begin(), sorted.end());
+
+    double sum = 0;
+    for (double sample : sorted) {
+      sum += sample;
+    }
+    stats.push_back({.name = name,
+                     .samples = sorted.size(),
+                     .average = sum / sorted.size(),
+                     .p50 = percentile(sorted, 0.50),
+                     .p95 = percentile(sorted, 0.95),
+                     .p99 = percentile(sorted, 0.99)});
+  }
+  return stats;
+}
+
+double GpuProfiler::percentile(std::span<const double> sorted, double p) {
+  size_t rank = (size_t)(p * (sorted.size() - 1) + 0.5);
+  return sorted[rank];
+}
@@ -0,0 +1,476 @@
+#include "vk_rendergraph.h"
+
+#include <vk_initializers.h>
+#include <vk_profiler.h>
+
+#include <algorithm>
+
+namespace {
+constexpr VkAccessFlags2 WRITE_ACCESS =
+    VK_ACCESS_2_SHADER_WRITE_BIT | VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT |
+    VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT |
+    VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT |
+    VK_ACCESS_2_TRANSFER_WRITE_BIT | VK_ACCESS_2_HOST_WRITE_BIT |
+    VK_ACCESS_2_MEMORY_WRITE_BIT;
+
+VkDeviceSize align_up(VkDeviceSize value, VkDeviceSize alignment) {
+  return (value + alignment - 1) / alignment * alignment;
+}
+
+// the fields the engine varies, images matching on these are interchangeable
+bool same_image(const VkImageCreateInfo &a, const VkImageCreateInfo &b) {
+  return a.imageType == b.imageType && a.format == b.format &&
+         a.extent.width == b.extent.width &&
+         a.extent.height == b.extent.height &&
+         a.extent.depth == b.extent.depth && a.mipLevels == b.mipLevels &&
+         a.arrayLayers == b.arrayLayers && a.samples == b.samples &&
+         a.tiling == b.tiling && a.usage == b.usage && a.flags == b.flags;
+}
+} // namespace
+
+RenderGraph::PassBuilder &RenderGraph::PassBuilder::read(ResourceId resource,
+                                                         ResourceUsage usage) {
+  pass.accesses.push_back({resource, usage, false, false});
+  return *this;
+}
+
+RenderGraph::PassBuilder &RenderGraph::PassBuilder::write(ResourceId resource,
+                                                          ResourceUsage usage) {
+  pass.accesses.push_back({resource, usage, true, false});
+  return *this;
+}
+
+RenderGraph::PassBuilder &
+RenderGraph::PassBuilder::overwrite(ResourceId resource, ResourceUsage usage) {
+  pass.accesses.push_back({resource, usage, true, true});
+  return *this;
+}
+
+void RenderGraph::init(VkDevice device, VmaAllocator allocator) {
+  _device = device;
+  _allocator = allocator;
+}
+
+void RenderGraph::destroy() {
+  vkDeviceWaitIdle(_device);
+  free_transients();
+  _transients.clear();
+}
+
+void RenderGraph::reset() {
+  resources.clear();
+  passes.clear();
+  _current.clear();
+}
+
+RenderGraph::ResourceId
+RenderGraph::import_image(std::string name, VkImage image,
+                          VkImageAspectFlags aspect,
+                          std::optional<ResourceState> entry) {
+  ResourceState &state = _states[(uint64_t)image];
+  if (entry) {
+    state = *entry;
+  }
+
+  resources.push_back(
+      {.name = std::move(name), .image = image, .aspect = aspect});
+  _current.push_back(&state);
+  return (ResourceId)resources.size() - 1;
+}
+
+RenderGraph::ResourceId RenderGraph::import_buffer(std::string name,
+                                                   VkBuffer buffer) {
+  resources.push_back({.name = std::move(name), .buffer = buffer});
+  _current.push_back(&_states[(uint64_t)buffer]);
+  return (ResourceId)resources.size() - 1;
+}
+
+RenderGraph::ResourceId RenderGraph::create_image(std::string name,
+                                                  const VkImageCreateInfo &info,
+                                                  VkImageAspectFlags aspect) {
+  resources.push_back({.name = std::move(name),
+                       .aspect = aspect,
+                       .transient = true,
+                       .imageInfo = info});
+  // the state is only known once compile() has the image
+  _current.push_back(nullptr);
+  return (ResourceId)resources.size() - 1;
+}
+
+void RenderGraph::export_resource(ResourceId resource,
+                                  std::optional<ResourceUsage> usage) {
+  resources[resource].exported = true;
+  resources[resource].exportUsage = usage;
+}
+
+RenderGraph::PassBuilder RenderGraph::add_pass(std::string name,
+                                               RecordFn record) {
+  passes.push_back({.name = std::move(name), .record = std::move(record)});
+  return {passes.back()};
+}
+
+void RenderGraph::cull_passes() {
+  // walk backwards from the exported resources. a pass survives when a later
+  // pass or the outside needs something it writes, and then needs its inputs
+  std::vector<bool> needed(resources.size());
+  for (size_t i = 0; i < resources.size(); ++i) {
+    needed[i] = resources[i].exported;
+  }
+
+  culledPasses = 0;
+  for (auto pass = passes.rbegin(); pass != passes.rend(); ++pass) {
+    pass->culled = true;
+    for (const Access &access : pass->accesses) {
+      if (access.write && needed[access.resource]) {
+        pass->culled = false;
+      }
+    }
+    if (pass->culled) {
+      culledPasses++;
+      continue;
+    }
+
+    // whatever an overwrite replaces is not needed from earlier passes
+    for (const Access &access : pass->accesses) {
+      if (access.discard) {
+        needed[access.resource] = false;
+      }
+    }
+    for (const Access &access : pass->accesses) {
+      if (!access.discard) {
+        needed[access.resource] = true;
+      }
+    }
+  }
+}
+
+bool RenderGraph::place_transients() {
+  // lifetime of every transient, as the range of live passes touching it
+  constexpr uint32_t UNUSED = UINT32_MAX;
+  std::vector<uint32_t> first(resources.size(), UNUSED);
+  std::vector<uint32_t> last(resources.size(), 0);
+  for (uint32_t p = 0; p < passes.size(); ++p) {
+    if (passes[p].culled) {
+      continue;
+    }
+    for (const Access &access : passes[p].accesses) {
+      first[access.resource] = std::min(first[access.resource], p);
+      last[access.resource] = std::max(last[access.resource], p);
+    }
+  }
+
+  bool changed = _transientMemory == nullptr;
+  std::vector<ResourceId> transients;
+  for (ResourceId id = 0; id < resources.size(); ++id) {
+    if (!resources[id].transient) {
+      continue;
+    }
+    transients.push_back(id);
+
+    Transient &transient = _transients[resources[id].name];
+    if (transient.image == VK_NULL_HANDLE ||
+        !same_image(transient.info, resources[id].imageInfo)) {
+      transient.info = resources[id].imageInfo;
+      VkDeviceImageMemoryRequirements query{
+          .sType = VK_STRUCTURE_TYPE_DEVICE_IMAGE_MEMORY_REQUIREMENTS};
+      query.pCreateInfo = &transient.info;
+      VkMemoryRequirements2 requirements{
+          .sType = VK_STRUCTURE_TYPE_MEMORY_REQUIREMENTS_2};
+      vkGetDeviceImageMemoryRequirements(_device, &query, &requirements);
+      transient.requirements = requirements.memoryRequirements;
+      changed = true;
+    }
+  }
+  // a transient the graph no longer declares frees its memory
+  changed |= _transients.size() != transients.size();
+
+  // biggest first, each at the lowest offset that does not overlap the
+  // memory of a placed image it is alive together with. images no live pass
+  // uses alias everything at the start of the block
+  std::sort(transients.begin(), transients.end(),
+            [&](ResourceId a, ResourceId b) {
+              return _transients[resources[a].name].requirements.size >
+                     _transients[resources[b].name].requirements.size;
+            });
+
+  std::vector<VkDeviceSize> offsets(resources.size(), 0);
+  std::vector<ResourceId> placed;
+  VkDeviceSize blockSize = 0;
+  VkDeviceSize alignment = 1;
+  uint32_t memoryTypeBits = ~0u;
+  transientMemory = {};
+  for (ResourceId id : transients) {
+    const VkMemoryRequirements &req =
+        _transients[resources[id].name].requirements;
+    alignment = std::max(alignment, req.alignment);
+    memoryTypeBits &= req.memoryTypeBits;
+    transientMemory.dedicated += req.size;
+
+    auto overlaps = [&](ResourceId other, VkDeviceSize offset) {
+      const VkMemoryRequirements &otherReq =
+          _transients[resources[other].name].requirements;
+      bool together = first[id] != UNUSED && first[other] != UNUSED &&
+                      first[id] <= last[other] && first[other] <= last[id];
+      return together && offset < offsets[other] + otherReq.size &&
+             offsets[other] < offset + req.size;
+    };
+
+    VkDeviceSize offset = 0;
+    if (first[id] != UNUSED) {
+      std::vector<VkDeviceSize> candidates{0};
+      for (ResourceId other : placed) {
+        VkDeviceSize end = offsets[other] +
+                           _transients[resources[other].name].requirements.size;
+        candidates.push_back(align_up(end, req.alignment));
+      }
+      std::sort(candidates.begin(), candidates.end());
+      for (VkDeviceSize candidate : candidates) {
+        if (std::none_of(placed.begin(), placed.end(), [&](ResourceId other) {
+              return overlaps(other, candidate);
+            })) {
+          offset = candidate;
+          break;
+        }
+      }
+    }
+
+    offsets[id] = offset;
+    placed.push_back(id);
+    blockSize = std::max(blockSize, offset + req.size);
+
+    changed |= _transients[resources[id].name].offset != offset;
+  }
+  changed |= blockSize != _transientMemorySize;
+  transientMemory.aliased = blockSize;
+
+  if (changed) {
+    // the old images may still be in use by frames in flight
+    vkDeviceWaitIdle(_device);
+    free_transients();
+
+    if (memoryTypeBits == 0) {
+      fmt::println("Transient images have no memory type in common");
+      abort();
+    }
+
+    VkMemoryRequirements blockRequirements{.size = blockSize,
+                                           .alignment = alignment,
+                                           .memoryTypeBits = memoryTypeBits};
+    VmaAllocationCreateInfo allocInfo{};
+    allocInfo.usage = VMA_MEMORY_USAGE_GPU_ONLY;
+    allocInfo.requiredFlags = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+    VK_CHECK(vmaAllocateMemory(_allocator, &blockRequirements, &allocInfo,
+                               &_transientMemory, nullptr));
+    _transientMemorySize = blockSize;
+
+    for (ResourceId id : transients) {
+      Transient &transient = _transients[resources[id].name];
+      transient.offset = offsets[id];
+      VK_CHECK(vkCreateImage(_device, &transient.info, nullptr,
+                             &transient.image));
+      VK_CHECK(vmaBindImageMemory2(_allocator, _transientMemory,
+                                   transient.offset, transient.image,
+                                   nullptr));
+    }
+  }
+
+  for (ResourceId id : transients) {
+    Resource &resource = resources[id];
+    const Transient &transient = _transients[resource.name];
+    resource.image = transient.image;
+    _current[id] = &_states[(uint64_t)transient.image];
+
+    VkDeviceSize size = transient.requirements.size;
+    resource.aliases.clear();
+    for (ResourceId other : transients) {
+      const Transient &o = _transients[resources[other].name];
+      if (other != id && transient.offset < o.offset + o.requirements.size &&
+          o.offset < transient.offset + size) {
+        resource.aliases.push_back(other);
+      }
+    }
+  }
+
+  return changed;
+}
+
+void RenderGraph::free_transients() {
+  for (auto &[name, transient] : _transients) {
+    if (transient.image != VK_NULL_HANDLE) {
+      _states.erase((uint64_t)transient.image);
+      vkDestroyImage(_device, transient.image, nullptr);
+      transient.image = VK_NULL_HANDLE;
+    }
+  }
+  // names declared last frame but not this one are dropped for good
+  std::erase_if(_transients, [&](const auto &entry) {
+    return std::none_of(resources.begin(), resources.end(),
+                        [&](const Resource &r) {
+                          return r.transient && r.name == entry.first;
+                        });
+  });
+
+  if (_transientMemory) {
+    vmaFreeMemory(_allocator, _transientMemory);
+    _transientMemory = nullptr;
+    _transientMemorySize = 0;
+  }
+}
+
+void RenderGraph::add_barrier(Barriers &barriers, ResourceId id,
+                              const ResourceUsage &usage, bool write,
+                              bool discard) {
+  const Resource &resource = resources[id];
+  ResourceState &state = *_current[id];
+
+  bool isImage = resource.image != VK_NULL_HANDLE;
+  bool transition = isImage && state.layout != usage.layout;
+
+  VkPipelineStageFlags2 srcStages;
+  VkAccessFlags2 srcAccess;
+  if (write || transition) {
+    // waits for the last write and for every read since, the reads only need
+    // to have executed
+    srcStages = state.writeStages | state.readStages;
+    srcAccess = state.writeAccess;
+    if (srcStages == VK_PIPELINE_STAGE_2_NONE && !transition) {
+      // first access of the frame with nothing to wait for
+      state.writeStages = usage.stage;
+      state.writeAccess = usage.access & WRITE_ACCESS;
+      return;
+    }
+  } else {
+    // reads only wait for the last write, once per stage and access
+    bool visible = (usage.stage & ~state.readStages) == 0 &&
+                   (usage.access & ~state.readAccess) == 0;
+    if (state.writeStages == VK_PIPELINE_STAGE_2_NONE || visible) {
+      state.readStages |= usage.stage;
+      state.readAccess |= usage.access;
+      return;
+    }
+    srcStages = state.writeStages;
+    srcAccess = state.writeAccess;
+  }
+
+  if (isImage) {
+    VkImageMemoryBarrier2 barrier{.sType =
+                                      VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2};
+    barrier.srcStageMask = srcStages;
+    barrier.srcAccessMask = srcAccess;
+    barrier.dstStageMask = usage.stage;
+    barrier.dstAccessMask = usage.access;
+    barrier.oldLayout = discard ? VK_IMAGE_LAYOUT_UNDEFINED : state.layout;
+    barrier.newLayout = usage.layout;
+    barrier.image = resource.image;
+    barrier.subresourceRange =
+        vkinit::image_subresource_range(resource.aspect);
+    barriers.images.push_back(barrier);
+  } else {
+    VkBufferMemoryBarrier2 barrier{
+        .sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER_2};
+    barrier.srcStageMask = srcStages;
+    barrier.srcAccessMask = srcAccess;
+    barrier.dstStageMask = usage.stage;
+    barrier.dstAccessMask = usage.access;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.buffer = resource.buffer;
+    barrier.offset = 0;
+    barrier.size = VK_WHOLE_SIZE;
+    barriers.buffers.push_back(barrier);
+  }
+
+  if (isImage) {
+    state.layout = usage.layout;
+  }
+  if (write) {
+    state.writeStages = usage.stage;
+    state.writeAccess = usage.access & WRITE_ACCESS;
+    state.readStages = VK_PIPELINE_STAGE_2_NONE;
+    state.readAccess = VK_ACCESS_2_NONE;
+  } else if (transition) {
+    // the layout transition acts as a write the reader already waited for,
+    // later readers in other stages chain through this one
+    state.writeStages = usage.stage;
+    state.writeAccess = VK_ACCESS_2_NONE;
+    state.readStages = usage.stage;
+    state.readAccess = usage.access;
+  } else {
+    state.readStages |= usage.stage;
+    state.readAccess |= usage.access;
+  }
+}
+
+void RenderGraph::flush_barriers(VkCommandBuffer cmd, Barriers &barriers) {
+  if (barriers.images.empty() && barriers.buffers.empty()) {
+    return;
+  }
+
+  VkDependencyInfo depInfo{.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO};
+  depInfo.imageMemoryBarrierCount = (uint32_t)barriers.images.size();
+  depInfo.pImageMemoryBarriers = barriers.images.data();
+  depInfo.bufferMemoryBarrierCount = (uint32_t)barriers.buffers.size();
+  depInfo.pBufferMemoryBarriers = barriers.buffers.data();
+  vkCmdPipelineBarrier2(cmd, &depInfo);
+
+  barrierBatches++;
+  imageBarriers += (uint32_t)barriers.images.size();
+  bufferBarriers += (uint32_t)barriers.buffers.size();
+  barriers.images.clear();
+  barriers.buffers.clear();
+}
+
+bool RenderGraph::compile() {
+  cull_passes();
+  _touched.assign(resources.size(), false);
+  return place_transients();
+}
+
+void RenderGraph::execute(VkCommandBuffer cmd) {
+  barrierBatches = imageBarriers = bufferBarriers = 0;
+
+  Barriers barriers;
+  for (Pass &pass : passes) {
+    if (pass.culled) {
+      continue;
+    }
+    for (const Access &access : pass.accesses) {
+      bool discard = access.discard;
+      const Resource &resource = resources[access.resource];
+      if (resource.transient && !_touched[access.resource]) {
+        // nothing survives from the last frame, and whatever was placed in
+        // the same memory since has to be done with it first
+        ResourceState &state = *_current[access.resource];
+        for (ResourceId alias : resource.aliases) {
+          const ResourceState &other = *_current[alias];
+          state.writeStages |= other.writeStages | other.readStages;
+          state.writeAccess |= other.writeAccess;
+        }
+        state.layout = VK_IMAGE_LAYOUT_UNDEFINED;
+        discard = true;
+      }
+      _touched[access.resource] = true;
+
+      add_barrier(barriers, access.resource, access.usage, access.write,
+                  discard);
+    }
+    flush_barriers(cmd, barriers);
+
+    GpuProfiler::ScopeId scope = GpuProfiler::NO_SCOPE;
+    if (profiler) {
+      scope = profiler->begin_scope(cmd, pass.name);
+    }
+    pass.record(cmd);
+    if (profiler) {
+      profiler->end_scope(cmd, scope);
+    }
+  }
+
+  // hand the exported resources over to whatever comes after the graph
+  for (ResourceId id = 0; id < resources.size(); ++id) {
+    if (resources[id].exportUsage) {
+      add_barrier(barriers, id, *resources[id].exportUsage, false, false);
+    }
+  }
+  flush_barriers(cmd, barriers);
+}
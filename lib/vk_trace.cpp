@@ -0,0 +1,161 @@
+#include "vk_trace.h"
+
+#include <fmt/core.h>
+
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace {
+struct Event {
+  const char *name;
+  int64_t start;
+  int64_t end;
+};
+
+// only its own thread pushes, the lock is there for the export and is
+// uncontended otherwise
+struct ThreadBuffer {
+  std::mutex mutex;
+  std::vector<Event> events;
+  const char *name{nullptr};
+  uint32_t id;
+};
+
+struct Capture {
+  std::mutex mutex;
+  // owned here so the events of threads that already exited survive
+  std::vector<std::unique_ptr<ThreadBuffer>> threads;
+  uint32_t remainingFrames{0};
+  // waiting for the current frame to end before capturing
+  bool armed{false};
+  std::filesystem::path path;
+  int64_t start{0};
+};
+
+Capture &capture() {
+  static Capture instance;
+  return instance;
+}
+
+thread_local ThreadBuffer *tlsBuffer = nullptr;
+
+ThreadBuffer &thread_buffer() {
+  if (!tlsBuffer) {
+    Capture &c = capture();
+    std::lock_guard lock{c.mutex};
+    auto buffer = std::make_unique<ThreadBuffer>();
+    buffer->id = (uint32_t)c.threads.size();
+    buffer->events.reserve(4096);
+    tlsBuffer = buffer.get();
+    c.threads.push_back(std::move(buffer));
+  }
+  return *tlsBuffer;
+}
+
+void write_trace(Capture &c) {
+  std::string out = "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+  size_t eventCount = 0;
+  bool first = true;
+  auto separator = [&]() {
+    if (!first) {
+      out += ",\n";
+    }
+    first = false;
+  };
+
+  for (auto &thread : c.threads) {
+    std::lock_guard lock{thread->mutex};
+    separator();
+    out += fmt::format("{{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,"
+                       "\"tid\":{},\"args\":{{\"name\":\"",
+                       thread->id);
+    if (thread->name) {
+      cputrace::append_json_escaped(out, thread->name);
+    } else {
+      out += fmt::format("thread {}", thread->id);
+    }
+    out += "\"}}";
+
+    // complete events, in microseconds since the capture started
+    for (const Event &event : thread->events) {
+      separator();
+      out += "{\"name\":\"";
+      cputrace::append_json_escaped(out, event.name);
+      out += fmt::format("\",\"ph\":\"X\",\"pid\":1,\"tid\":{},\"ts\":{:.3f},"
+                         "\"dur\":{:.3f}}}",
+                         thread->id, (event.start - c.start) / 1000.0,
+                         (event.end - event.start) / 1000.0);
+    }
+    eventCount += thread->events.size();
+  }
+  out += "\n]}\n";
+
+  std::ofstream file(c.path, std::ios::binary | std::ios::trunc);
+  file.write(out.data(), out.size());
+  if (!file) {
+    fmt::println("Failed to write the cpu trace to {}", c.path.string());
+    return;
+  }
+  fmt::println("Wrote {} cpu zones to {}", eventCount, c.path.string());
+}
+} // namespace
+
+void cputrace::begin_capture(uint32_t frames, std::filesystem::path path) {
+  Capture &c = capture();
+  std::lock_guard lock{c.mutex};
+  c.remainingFrames = frames;
+  c.armed = frames > 0;
+  c.path = std::move(path);
+}
+
+void cputrace::end_frame() {
+  Capture &c = capture();
+  std::lock_guard lock{c.mutex};
+  // whole frames only, the capture starts with the next one
+  if (c.armed) {
+    for (auto &thread : c.threads) {
+      std::lock_guard threadLock{thread->mutex};
+      thread->events.clear();
+    }
+    c.armed = false;
+    c.start = detail::now();
+    detail::capturing = true;
+    return;
+  }
+  if (c.remainingFrames == 0 || --c.remainingFrames > 0) {
+    return;
+  }
+  detail::capturing = false;
+  write_trace(c);
+}
+
+uint32_t cputrace::remaining_frames() {
+  Capture &c = capture();
+  std::lock_guard lock{c.mutex};
+  return c.remainingFrames;
+}
+
+void cputrace::set_thread_name(const char *name) {
+  ThreadBuffer &buffer = thread_buffer();
+  std::lock_guard lock{buffer.mutex};
+  buffer.name = name;
+}
+
+void cputrace::append_json_escaped(std::string &out, std::string_view text) {
+  for (char c : text) {
+    if (c == '"' || c == '\\') {
+      out.push_back('\\');
+    }
+    out.push_back(c);
+  }
+}
+
+void cputrace::detail::record(const char *name, int64_t start, int64_t end) {
+  ThreadBuffer &buffer = thread_buffer();
+  std::lock_guard lock{buffer.mutex};
+  buffer.events.push_back({name, start, end});
+}
@@ -0,0 +1,174 @@
+#include "vk_upload.h"
+
+#include <vk_initializers.h>
+
+#include <algorithm>
+
+namespace {
+// keeps copies starting on a 16 byte boundary of the ring
+constexpr VkDeviceSize RING_ALIGNMENT = 16;
+
+VkDeviceSize align_up(VkDeviceSize value, VkDeviceSize alignment) {
+  return (value + alignment - 1) / alignment * alignment;
+}
+} // namespace
+
+void UploadManager::init(VkDevice device_, VmaAllocator allocator,
+                         VkQueue queue_, uint32_t queueFamily_,
+                         VkDeviceSize size) {
+  device = device_;
+  queue = queue_;
+  queueFamily = queueFamily_;
+
+  ringSize = align_up(size, RING_ALIGNMENT);
+  head = 0;
+  tail = 0;
+
+  // the staging ring stays mapped for the lifetime of the manager
+  VkBufferCreateInfo bufferInfo = {.sType =
+                                       VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO};
+  bufferInfo.size = ringSize;
+  bufferInfo.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+
+  VmaAllocationCreateInfo vmaallocInfo = {};
+  vmaallocInfo.usage = VMA_MEMORY_USAGE_CPU_ONLY;
+  vmaallocInfo.flags = VMA_ALLOCATION_CREATE_MAPPED_BIT;
+
+  VK_CHECK(vmaCreateBuffer(allocator, &bufferInfo, &vmaallocInfo, &ring.buffer,
+                           &ring.allocation, &ring.info));
+  ringData = (char *)ring.info.pMappedData;
+
+  VkSemaphoreTypeCreateInfo timelineInfo{
+      .sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO};
+  timelineInfo.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+  timelineInfo.initialValue = 0;
+
+  VkSemaphoreCreateInfo semaphoreInfo = vkinit::semaphore_create_info();
+  semaphoreInfo.pNext = &timelineInfo;
+  VK_CHECK(vkCreateSemaphore(device, &semaphoreInfo, nullptr, &timeline));
+  submittedValue = 0;
+
+  VkCommandPoolCreateInfo commandPoolInfo = vkinit::command_pool_create_info(
+      queueFamily, VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT |
+                       VK_COMMAND_POOL_CREATE_TRANSIENT_BIT);
+  VK_CHECK(
+      vkCreateCommandPool(device, &commandPoolInfo, nullptr, &commandPool));
+  recording = VK_NULL_HANDLE;
+}
+
+void UploadManager::destroy(VmaAllocator allocator) {
+  vkDestroyCommandPool(device, commandPool, nullptr);
+  vkDestroySemaphore(device, timeline, nullptr);
+  vmaDestroyBuffer(allocator, ring.buffer, ring.allocation);
+
+  inFlight.clear();
+  freeCommandBuffers.clear();
+}
+
+void UploadManager::upload(VkBuffer dst, VkDeviceSize dstOffset,
+                           const void *data, VkDeviceSize size) {
+  const char *src = (const char *)data;
+
+  while (size > 0) {
+    VkDeviceSize offset;
+    VkDeviceSize chunk = reserve(size, &offset);
+
+    memcpy(ringData + offset, src, chunk);
+
+    VkBufferCopy copy{
+        .srcOffset = offset, .dstOffset = dstOffset, .size = chunk};
+    vkCmdCopyBuffer(begin_recording(), ring.buffer, dst, 1, &copy);
+
+    head = align_up(head + chunk, RING_ALIGNMENT);
+    src += chunk;
+    dstOffset += chunk;
+    size -= chunk;
+  }
+}
+
+uint64_t UploadManager::flush() {
+  if (recording == VK_NULL_HANDLE) {
+    return submittedValue;
+  }
+
+  VK_CHECK(vkEndCommandBuffer(recording));
+
+  VkCommandBufferSubmitInfo cmdinfo =
+      vkinit::command_buffer_submit_info(recording);
+
+  VkSemaphoreSubmitInfo signalInfo = vkinit::semaphore_submit_info(
+      VK_PIPELINE_STAGE_2_ALL_TRANSFER_BIT, timeline);
+  signalInfo.value = ++submittedValue;
+
+  VkSubmitInfo2 submit = vkinit::submit_info(&cmdinfo, {&signalInfo, 1}, {});
+  VK_CHECK(vkQueueSubmit2(queue, 1, &submit, VK_NULL_HANDLE));
+
+  inFlight.push_back(
+      {.cmd = recording, .timelineValue = submittedValue, .ringEnd = head});
+  recording = VK_NULL_HANDLE;
+
+  return submittedValue;
+}
+
+void UploadManager::wait(uint64_t value) {
+  VkSemaphoreWaitInfo waitInfo{.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO};
+  waitInfo.semaphoreCount = 1;
+  waitInfo.pSemaphores = &timeline;
+  waitInfo.pValues = &value;
+
+  VK_CHECK(vkWaitSemaphores(device, &waitInfo, UINT64_MAX));
+  retire();
+}
+
+VkDeviceSize UploadManager::reserve(VkDeviceSize size,
+                                    VkDeviceSize *outOffset) {
+  for (;;) {
+    retire();
+
+    // head is always aligned, and a chunk never wraps past the end of the ring
+    VkDeviceSize offset = head % ringSize;
+    VkDeviceSize freeBytes = ringSize - (head - tail);
+    VkDeviceSize chunk = std::min({size, freeBytes, ringSize - offset});
+    if (chunk > 0) {
+      *outOffset = offset;
+      return chunk;
+    }
+
+    // the ring is full: submit what is recorded and wait for the oldest copies
+    flush();
+    wait(inFlight.front().timelineValue);
+  }
+}
+
+VkCommandBuffer UploadManager::begin_recording() {
+  if (recording != VK_NULL_HANDLE) {
+    return recording;
+  }
+
+  if (freeCommandBuffers.empty()) {
+    VkCommandBufferAllocateInfo cmdAllocInfo =
+        vkinit::command_buffer_allocate_info(commandPool, 1);
+    VK_CHECK(vkAllocateCommandBuffers(device, &cmdAllocInfo, &recording));
+  } else {
+    recording = freeCommandBuffers.back();
+    freeCommandBuffers.pop_back();
+    VK_CHECK(vkResetCommandBuffer(recording, 0));
+  }
+
+  VkCommandBufferBeginInfo cmdBeginInfo = vkinit::command_buffer_begin_info(
+      VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT);
+  VK_CHECK(vkBeginCommandBuffer(recording, &cmdBeginInfo));
+
+  return recording;
+}
+
+void UploadManager::retire() {
+  uint64_t completed;
+  VK_CHECK(vkGetSemaphoreCounterValue(device, timeline, &completed));
+
+  while (!inFlight.empty() && inFlight.front().timelineValue <= completed) {
+    tail = inFlight.front().ringEnd;
+    freeCommandBuffers.push_back(inFlight.front().cmd);
+    inFlight.pop_front();
+  }
+}
@@ -0,0 +1,19 @@
+#include "vk_util.h"
+
+void vkutil::memory_barrier(VkCommandBuffer cmd,
+                            VkPipelineStageFlags2 srcStage,
+                            VkAccessFlags2 srcAccess,
+                            VkPipelineStageFlags2 dstStage,
+                            VkAccessFlags2 dstAccess) {
+  VkMemoryBarrier2 memoryBarrier{.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2};
+  memoryBarrier.srcStageMask = srcStage;
+  memoryBarrier.srcAccessMask = srcAccess;
+  memoryBarrier.dstStageMask = dstStage;
+  memoryBarrier.dstAccessMask = dstAccess;
+
+  VkDependencyInfo depInfo{.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO};
+  depInfo.memoryBarrierCount = 1;
+  depInfo.pMemoryBarriers = &memoryBarrier;
+
+  vkCmdPipelineBarrier2(cmd, &depInfo);
+}